@@ -0,0 +1,406 @@
+/******************************************************************
+
+结构体绑定：把JSON直接解析到C++结构体中，或从结构体直接生成JSON，
+中间不构造Value。
+
+    struct Point { double x; double y; };
+    JSONCPP_FIELDS(Point, x, y)         // 必须写在全局作用域
+
+    Point p;
+    Json_Parse_Into("{\"x\":1,\"y\":2}", p);
+    std::string json;
+    Json_Generate_From(json, p);
+
+支持的成员类型：算术类型、bool、std::string、std::vector<T>、Optional<T>、
+Value，以及其他用JSONCPP_FIELDS声明过的结构体。
+也可以不用宏，直接特化Fields<T>。
+
+*******************************************************************/
+#ifndef JsonBind_H_
+#define JsonBind_H_
+
+#include "JsonCpp.h"
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace JsonCpp
+{
+
+// 可缺省的成员：JSON中不存在或为null时has_value为false，生成时省略该键
+template<typename T>
+struct Optional
+{
+    bool has_value = false;
+    T value = T();
+
+    Optional &operator=(const T &v)
+    {
+        value = v;
+        has_value = true;
+        return *this;
+    }
+};
+
+// 结构体的字段表，visit按声明顺序对每个字段调用f(名字, 成员)，
+// keys()返回同样顺序的字段名，解析时用它把键映射为字段序号
+template<typename T>
+struct Fields
+{
+    static const bool value = false;
+};
+
+// Bind<T>::read从Reader读入T，Bind<T>::write把T写到Emitter
+template<typename T, typename Enable = void>
+struct Bind;
+
+template<typename T>
+inline bool bind_present(const T &)
+{
+    return true;
+}
+
+template<typename T>
+inline bool bind_present(const Optional<T> &o)
+{
+    return o.has_value;
+}
+
+template<>
+struct Bind<bool>
+{
+    static int read(Reader &r, bool &b)
+    {
+        return r.read(b);
+    }
+    static void write(Emitter &w, const bool &b)
+    {
+        if(b){
+            w.put_raw("true", 4);
+        }
+        else{
+            w.put_raw("false", 5);
+        }
+    }
+};
+
+template<typename T>
+struct Bind<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static int read(Reader &r, T &t)
+    {
+        double d;
+        int ret = r.read(d);
+        if(ret == PARSE_OK){
+            t = (T)d;
+        }
+        return ret;
+    }
+    static void write(Emitter &w, const T &t)
+    {
+        w.put_number((double)t);
+    }
+};
+
+// 整数类型要求JSON中的数字为整数且不越界，按64位整数读写，不经过double
+template<typename T>
+struct Bind<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type>
+{
+    static int read(Reader &r, T &t)
+    {
+        int64_t i;
+        int ret = r.read(i);
+        if(ret != PARSE_OK){
+            return ret;
+        }
+        if(i < (int64_t)std::numeric_limits<T>::min() || i > (int64_t)std::numeric_limits<T>::max()){
+            return PARSE_TYPE_MISMATCH;
+        }
+        t = (T)i;
+        return PARSE_OK;
+    }
+    static void write(Emitter &w, const T &t)
+    {
+        w.put_int64((int64_t)t);
+    }
+};
+
+template<typename T>
+struct Bind<T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value
+                                       && !std::is_same<T, bool>::value>::type>
+{
+    static int read(Reader &r, T &t)
+    {
+        uint64_t u;
+        int ret = r.read(u);
+        if(ret != PARSE_OK){
+            return ret;
+        }
+        if(u > (uint64_t)std::numeric_limits<T>::max()){
+            return PARSE_TYPE_MISMATCH;
+        }
+        t = (T)u;
+        return PARSE_OK;
+    }
+    static void write(Emitter &w, const T &t)
+    {
+        w.put_uint64((uint64_t)t);
+    }
+};
+
+template<>
+struct Bind<std::string>
+{
+    static int read(Reader &r, std::string &s)
+    {
+        return r.read(s);
+    }
+    static void write(Emitter &w, const std::string &s)
+    {
+        w.put_string(s.data(), s.length());
+    }
+};
+
+template<>
+struct Bind<Value>
+{
+    static int read(Reader &r, Value &v)
+    {
+        return r.read(v);
+    }
+    static void write(Emitter &w, const Value &v)
+    {
+        std::string json;
+        Json_Generate(json, v);
+        w.put_raw(json.data(), json.length());
+    }
+};
+
+template<typename T, typename A>
+struct Bind<std::vector<T, A>>
+{
+    static int read(Reader &r, std::vector<T, A> &v)
+    {
+        int ret;
+        bool more;
+        if((ret = r.begin_array()) != PARSE_OK){
+            return ret;
+        }
+        v.clear();
+        for (size_t i = 0; ; ++i){
+            if((ret = r.array_next(i, more)) != PARSE_OK || !more){
+                return ret;
+            }
+            // 先读入局部变量：std::vector<bool>的back()返回的是代理对象
+            T item = T();
+            if((ret = Bind<T>::read(r, item)) != PARSE_OK){
+                return ret;
+            }
+            v.push_back(std::move(item));
+        }
+    }
+    static void write(Emitter &w, const std::vector<T, A> &v)
+    {
+        w.put_char('[');
+        for (size_t i = 0; i != v.size(); ++i){
+            if(i != 0){
+                w.put_char(',');
+            }
+            Bind<T>::write(w, v[i]);
+        }
+        w.put_char(']');
+    }
+};
+
+template<typename T>
+struct Bind<Optional<T>>
+{
+    static int read(Reader &r, Optional<T> &o)
+    {
+        if(r.peek() == JSON_NULL){
+            o.has_value = false;
+            return r.read_null();
+        }
+        int ret = Bind<T>::read(r, o.value);
+        o.has_value = ret == PARSE_OK;
+        return ret;
+    }
+    static void write(Emitter &w, const Optional<T> &o)
+    {
+        if(o.has_value){
+            Bind<T>::write(w, o.value);
+        }
+        else{
+            w.put_raw("null", 4);
+        }
+    }
+};
+
+// 结构体：键经KeySet直接映射为字段序号，未知的键直接跳过，缺少的键保持原值
+template<typename T>
+struct Bind<T, typename std::enable_if<Fields<T>::value>::type>
+{
+    // 按KeySet给出的下标找到对应的成员
+    struct FieldReader
+    {
+        Reader &r;
+        int id;
+        int index;
+        int ret;
+
+        template<typename M>
+        void operator()(const char *, M &m)
+        {
+            if(index++ == id){
+                ret = Bind<M>::read(r, m);
+            }
+        }
+    };
+
+    struct FieldWriter
+    {
+        Emitter &w;
+        size_t count;
+
+        template<typename M>
+        void operator()(const char *name, const M &m)
+        {
+            if(!bind_present(m)){
+                return;
+            }
+            if(count++ != 0){
+                w.put_char(',');
+            }
+            w.put_string(name, strlen(name));
+            w.put_char(':');
+            Bind<M>::write(w, m);
+        }
+    };
+
+    static int read(Reader &r, T &t)
+    {
+        int ret;
+        int id;
+        bool more;
+        const KeySet &keys = Fields<T>::keys();
+        if((ret = r.begin_object()) != PARSE_OK){
+            return ret;
+        }
+        for (size_t i = 0; ; ++i){
+            if((ret = r.object_next(i, keys, id, more)) != PARSE_OK || !more){
+                return ret;
+            }
+            if(id < 0){
+                ret = r.skip();
+            }
+            else{
+                FieldReader fr = {r, id, 0, PARSE_OK};
+                Fields<T>::visit(fr, t);
+                ret = fr.ret;
+            }
+            if(ret != PARSE_OK){
+                return ret;
+            }
+        }
+    }
+
+    static void write(Emitter &w, const T &t)
+    {
+        FieldWriter fw = {w, 0};
+        w.put_char('{');
+        Fields<T>::visit(fw, t);
+        w.put_char('}');
+    }
+};
+
+template<typename T>
+int Json_Parse_Into(const std::string &json, T &t)
+{
+    Reader reader(json);
+    int ret = Bind<T>::read(reader, t);
+    if(ret == PARSE_OK){
+        ret = reader.finish();
+    }
+    return ret;
+}
+
+template<typename T>
+int Json_Generate_From(std::string &json, const T &t)
+{
+    Emitter emitter(json);
+    Bind<T>::write(emitter, t);
+    emitter.finish();
+    return GENERATE_OK;
+}
+
+}  // namespace JsonCpp
+
+
+/****************JSONCPP_FIELDS**************/
+// JSONCPP_FIELDS(Type, a, b, c)展开为Fields<Type>的特化，最多支持32个字段
+#define JSONCPP_ARG_N(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, N, ...) N
+#define JSONCPP_NARG(...) JSONCPP_EXPAND(JSONCPP_ARG_N(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1))
+#define JSONCPP_EXPAND(x) x
+#define JSONCPP_CONCAT_(a, b) a##b
+#define JSONCPP_CONCAT(a, b) JSONCPP_CONCAT_(a, b)
+#define JSONCPP_FOR_EACH(m, ...) JSONCPP_EXPAND(JSONCPP_CONCAT(JSONCPP_FOR_EACH_, JSONCPP_NARG(__VA_ARGS__))(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_1(m, x) m(x)
+#define JSONCPP_FOR_EACH_2(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_1(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_3(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_2(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_4(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_3(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_5(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_4(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_6(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_5(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_7(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_6(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_8(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_7(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_9(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_8(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_10(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_9(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_11(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_10(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_12(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_11(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_13(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_12(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_14(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_13(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_15(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_14(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_16(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_15(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_17(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_16(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_18(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_17(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_19(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_18(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_20(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_19(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_21(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_20(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_22(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_21(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_23(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_22(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_24(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_23(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_25(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_24(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_26(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_25(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_27(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_26(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_28(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_27(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_29(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_28(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_30(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_29(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_31(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_30(m, __VA_ARGS__))
+#define JSONCPP_FOR_EACH_32(m, x, ...) m(x) JSONCPP_EXPAND(JSONCPP_FOR_EACH_31(m, __VA_ARGS__))
+
+#define JSONCPP_FIELD_VISIT(m) f(#m, s.m);
+#define JSONCPP_FIELD_NAME(m) #m,
+
+#define JSONCPP_FIELDS(Type, ...)                                   \
+    namespace JsonCpp {                                             \
+    template<>                                                      \
+    struct Fields<Type>                                             \
+    {                                                               \
+        static const bool value = true;                             \
+        template<typename F, typename S>                            \
+        static void visit(F &f, S &s)                               \
+        {                                                           \
+            JSONCPP_FOR_EACH(JSONCPP_FIELD_VISIT, __VA_ARGS__)      \
+        }                                                           \
+        static const KeySet &keys()                                 \
+        {                                                           \
+            static const KeySet k{                                  \
+                JSONCPP_FOR_EACH(JSONCPP_FIELD_NAME, __VA_ARGS__)   \
+            };                                                      \
+            return k;                                               \
+        }                                                           \
+    };                                                              \
+    }
+
+#endif
@@ -4,11 +4,176 @@
 #include <iostream>
 #include <cerrno>   // errno
 #include <cfloat>   // DBL_MAX
-//#include <cstdio>
+#include <cstring>  // memcpy memchr
+#include <cstdlib>  // realloc free strtol strtod
+#include <cmath>    // HUGE_VAL
+#include <cstdint>  // uintptr_t
+#include <cstdio>   // fopen
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <io.h>     // _read
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#ifdef JSONCPP_PROFILE
+#include <chrono>
+#endif
+
+// 对齐的SIMD读取可能越过字符串结尾的NUL(但不会跨页)，需要让AddressSanitizer忽略
+#if defined(__GNUC__) || defined(__clang__)
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define NO_SANITIZE_ADDRESS
+#endif
 
 
 namespace JsonCpp
 {
+/**********************************************************
+ *                                                        *
+ *                                                        *
+ *                      Profile                           *
+ *                                                        *
+ *                                                        *
+ * ********************************************************/
+#ifdef JSONCPP_PROFILE
+static thread_local ProfileSnapshot profile_data;
+
+static uint64_t profile_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 作用域结束时把耗时和pos的增量记入一个阶段
+class ProfileScope
+{
+    ProfileCounter &counter;
+    const size_t &pos;
+    size_t start_pos;
+    uint64_t start;
+public:
+    ProfileScope(profile_stage stage, const size_t &p)
+        : counter(profile_data.stages[stage]), pos(p), start_pos(p), start(profile_now()) {}
+    ~ProfileScope()
+    {
+        counter.count++;
+        counter.nanos += profile_now() - start;
+        counter.bytes += pos > start_pos ? pos - start_pos : 0;
+    }
+};
+
+// 一次完整的解析(PROFILE_PARSE)或生成(PROFILE_GENERATE)。其后依次是字符串、数字、容器三个阶段，
+// 容器阶段的耗时为整次调用减去字符串和数字的耗时
+class ProfileCall
+{
+    int stage;
+    const size_t &pos;
+    size_t start_pos;
+    uint64_t leaf_start;
+    uint64_t start;
+
+    uint64_t leaf_nanos() const
+    {
+        return profile_data.stages[stage + 1].nanos + profile_data.stages[stage + 2].nanos;
+    }
+public:
+    ProfileCall(profile_stage s, const size_t &p)
+        : stage(s), pos(p), start_pos(p), leaf_start(leaf_nanos()), start(profile_now()) {}
+    ~ProfileCall()
+    {
+        uint64_t elapsed = profile_now() - start;
+        uint64_t leaf = leaf_nanos() - leaf_start;
+        ProfileCounter &c = profile_data.stages[stage];
+        c.count++;
+        c.nanos += elapsed;
+        c.bytes += pos > start_pos ? pos - start_pos : 0;
+        profile_data.stages[stage + 3].nanos += elapsed > leaf ? elapsed - leaf : 0;
+        (stage == PROFILE_PARSE ? profile_data.parse_latency : profile_data.generate_latency).record(elapsed);
+    }
+};
+
+#define PROFILE_SCOPE(stage, pos)   ProfileScope profile_scope_(stage, pos)
+#define PROFILE_CALL(stage, pos)    ProfileCall profile_call_(stage, pos)
+#define PROFILE_COUNT(stage)        (profile_data.stages[stage].count++)
+#else
+#define PROFILE_SCOPE(stage, pos)   ((void)0)
+#define PROFILE_CALL(stage, pos)    ((void)0)
+#define PROFILE_COUNT(stage)        ((void)0)
+#endif
+
+void LatencyHistogram::record(uint64_t nanos)
+{
+    int i = 0;
+    while(i != 63 && (nanos >> (i + 1)) != 0){
+        ++i;
+    }
+    buckets[i]++;
+    count++;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    if(count == 0){
+        return 0;
+    }
+    uint64_t rank = (uint64_t)std::ceil(p * count);
+    rank = rank == 0 ? 1 : rank;
+    uint64_t seen = 0;
+    for (int i = 0; i != 63; ++i){
+        seen += buckets[i];
+        if(seen >= rank){
+            return (uint64_t)1 << (i + 1);
+        }
+    }
+    return UINT64_MAX;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &h)
+{
+    for (int i = 0; i != 64; ++i){
+        buckets[i] += h.buckets[i];
+    }
+    count += h.count;
+}
+
+void ProfileSnapshot::merge(const ProfileSnapshot &s)
+{
+    for (int i = 0; i != PROFILE_STAGE_COUNT; ++i){
+        stages[i].count += s.stages[i].count;
+        stages[i].nanos += s.stages[i].nanos;
+        stages[i].bytes += s.stages[i].bytes;
+    }
+    parse_latency.merge(s.parse_latency);
+    generate_latency.merge(s.generate_latency);
+}
+
+ProfileSnapshot Profile_Snapshot()
+{
+#ifdef JSONCPP_PROFILE
+    return profile_data;
+#else
+    return ProfileSnapshot();
+#endif
+}
+
+void Profile_Reset()
+{
+#ifdef JSONCPP_PROFILE
+    profile_data = ProfileSnapshot();
+#endif
+}
+
 /**********************************************************
  *                                                        *
  *                                                        *
@@ -22,51 +187,130 @@ int Json_Parse(const std::string &json, Value &value)
     return parser.run(value);
 }
 
+int Json_Parse(const std::string &json, Value &value, const ParseOptions &options)
+{
+    Parser parser(json);
+    parser.max_depth = options.max_depth;
+    parser.check_utf8 = options.validate_utf8;
+    parser.raw_numbers = options.raw_numbers;
+    return parser.run(value);
+}
+
+int Json_Parse_Projection(const std::string &json, const Projection &projection,
+                          std::vector<Value> &values, std::vector<bool> *found)
+{
+    std::vector<bool> tmp_found;
+    std::vector<bool> &hit = found ? *found : tmp_found;
+    values.assign(projection.size(), Value());
+    hit.assign(projection.size(), false);
+
+    Parser parser(json);
+    parser.parse_whitespace();
+    int ret = parser.select_value(projection, 0, values, hit);
+    if(ret == PARSE_OK){
+        parser.parse_whitespace();
+        if(parser.pos != json.length()){
+            ret = PARSE_ROOT_NOT_SINGULAR;
+        }
+    }
+    if(ret != PARSE_OK){
+        values.assign(projection.size(), Value());
+        hit.assign(projection.size(), false);
+    }
+    return ret;
+}
+
+int Json_Validate(const std::string &json, size_t *error_offset)
+{
+    ParseOptions options;
+    return Json_Validate(json, options, error_offset);
+}
+
+int Json_Validate(const std::string &json, const ParseOptions &options, size_t *error_offset)
+{
+    Parser parser(json);
+    parser.check_number_range = true;
+    parser.check_utf8 = options.validate_utf8;
+    parser.max_depth = options.max_depth;
+    parser.parse_whitespace();
+    int ret = parser.skip_value();
+    if(ret == PARSE_OK){
+        parser.parse_whitespace();
+        if(parser.pos != json.length()){
+            ret = PARSE_ROOT_NOT_SINGULAR;
+        }
+    }
+    if(error_offset){
+        *error_offset = ret == PARSE_OK ? json.length() : parser.pos;
+    }
+    return ret;
+}
+
 int Json_Generate(std::string &json, const Value &value)
 {
     Generator generator(json);
     return generator.run(value);
 }
 
-void Json_Print(std::ostream &os, const std::string &json)
+int Json_Generate(std::string &json, const Value &value, const GenerateOptions &options)
 {
-    int depth = 0;
-    size_t len = json.length();
-    for (int i = 0; i != len; ++i){
-        if(json[i] == '{' || json[i] == '['){
-            os << json[i];
-            os << "\n";
-            depth++;
-            for (int i = 0; i != depth; ++i){
-                os << "\t";
-            }
-            continue;
-        }
-        if(json[i] == '}' || json[i] == ']'){
-            depth--;
-            os << "\n";
-            for (int i = 0; i != depth; ++i){
-                os << "\t";
-            }
-            os << json[i];
-            continue;
-        }
+    Generator generator(json, options);
+    return generator.run(value);
+}
 
-        if(json[i] == ':'){
-            os << json[i];
-            os << " ";
-            continue;
-        }
-        if(json[i] == ','){
-           os << json[i];
-           os << "\n";
-           for (int i = 0; i != depth; ++i){
-                os << "\t";
-            }
-            continue; 
-        }
-        os << json[i];
+int Json_Snapshot(std::string &out, const Value &value)
+{
+    SnapshotWriter writer(out);
+    return writer.run(value);
+}
+
+int Json_Write_Snapshot(const std::string &path, const Value &value)
+{
+    std::string out;
+    int ret = Json_Snapshot(out, value);
+    if(ret != GENERATE_OK){
+        return ret;
+    }
+    // 先写临时文件再改名，正在mmap旧快照的进程不受影响
+    std::string tmp = path + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if(fp == nullptr){
+        return SNAPSHOT_IO_ERROR;
+    }
+    bool ok = fwrite(out.data(), 1, out.length(), fp) == out.length();
+    ok = fclose(fp) == 0 && ok;
+    if(!ok || rename(tmp.c_str(), path.c_str()) != 0){
+        remove(tmp.c_str());
+        return SNAPSHOT_IO_ERROR;
     }
+    return GENERATE_OK;
+}
+
+int MsgPack_Encode(std::string &out, const Value &value)
+{
+    MsgPackWriter writer(out);
+    return writer.run(value);
+}
+
+int MsgPack_Decode(const char *data, size_t len, Value &value)
+{
+    MsgPackReader reader(data, len);
+    return reader.run(value);
+}
+
+int MsgPack_Decode(const std::string &data, Value &value)
+{
+    return MsgPack_Decode(data.data(), data.length(), value);
+}
+
+void Json_Print(std::ostream &os, const std::string &json)
+{
+    FormatOptions options;
+    options.indent = 1;
+    options.indent_char = '\t';
+    std::string out;
+    Json_Pretty(out, json, options);
+    os.write(out.data(), out.length());
 }
 
 /**********************************************************
@@ -76,8 +320,69 @@ void Json_Print(std::ostream &os, const std::string &json)
  *                                                        *
  *                                                        *
  * ********************************************************/
+// 返回p处开始的合法UTF-8多字节序列的长度，非法时返回0
+// 序列被NUL截断时续字节检查必然失败，不会越界
+static size_t utf8_sequence_length(const unsigned char *p)
+{
+    unsigned char c = p[0];
+    if(c >= 0xC2 && c <= 0xDF){
+        return (p[1] & 0xC0) == 0x80 ? 2 : 0;
+    }
+    if(c >= 0xE0 && c <= 0xEF){
+        unsigned char lo = c == 0xE0 ? 0xA0 : 0x80;   // 排除过长编码
+        unsigned char hi = c == 0xED ? 0x9F : 0xBF;   // 排除代理区
+        return (p[1] >= lo && p[1] <= hi && (p[2] & 0xC0) == 0x80) ? 3 : 0;
+    }
+    if(c >= 0xF0 && c <= 0xF4){
+        unsigned char lo = c == 0xF0 ? 0x90 : 0x80;
+        unsigned char hi = c == 0xF4 ? 0x8F : 0xBF;
+        return (p[1] >= lo && p[1] <= hi && (p[2] & 0xC0) == 0x80 && (p[3] & 0xC0) == 0x80) ? 4 : 0;
+    }
+    return 0;
+}
+
+// 跳过字符串中无需特殊处理的字符，停在'"'、'\\'、控制字符(含结尾的NUL)上；
+// stop_non_ascii为真时也停在>=0x80的字节上
+NO_SANITIZE_ADDRESS
+static const char *scan_string_chars(const char *p, bool stop_non_ascii)
+{
+#if defined(__SSE2__)
+    // 先逐字节走到16字节对齐处，之后的对齐读取不会跨页，可以安全地读过结尾的NUL
+    for(; ((uintptr_t)p & 15) != 0; ++p){
+        unsigned char ch = (unsigned char)*p;
+        if(ch < 0x20 || ch == '\"' || ch == '\\' || (stop_non_ascii && ch >= 0x80)){
+            return p;
+        }
+    }
+    const __m128i quote = _mm_set1_epi8('\"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    for(;; p += 16){
+        __m128i x = _mm_load_si128((const __m128i *)p);
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash)),
+                                   _mm_cmpeq_epi8(_mm_min_epu8(x, control), x));
+        int mask = _mm_movemask_epi8(hit);
+        if(stop_non_ascii){
+            mask |= _mm_movemask_epi8(x);
+        }
+        if(mask != 0){
+            return p + __builtin_ctz(mask);
+        }
+    }
+#else
+    for(;; ++p){
+        unsigned char ch = (unsigned char)*p;
+        if(ch < 0x20 || ch == '\"' || ch == '\\' || (stop_non_ascii && ch >= 0x80)){
+            return p;
+        }
+    }
+#endif
+}
+
 int Parser::run(Value &v)
 {
+    PROFILE_CALL(PROFILE_PARSE, pos);
+    v.set_null();
     parse_whitespace();
     int ret = parse_value(v);
     if(ret == PARSE_OK){
@@ -98,7 +403,88 @@ void Parser::parse_whitespace()
     }
 }
 
+// 解析一个值。数组和对象不在C栈上递归：正在构造的容器保存在显式的栈中，
+// 嵌套层数超过max_depth时返回PARSE_DEPTH_EXCEEDED
 int Parser::parse_value(Value &v)
+{
+    struct Frame{
+        bool is_object;
+        std::vector<Value> items;
+        std::unordered_map<std::string, Value> members;
+        std::string key;                    // 对象中正在解析的值对应的键
+    };
+    std::vector<Frame> stack;
+    Value tmp;
+    int ret;
+    while(1){
+        /**********一个值的开始***************/
+        char ch = json[pos];
+        if(ch == '[' || ch == '{'){
+            if(stack.size() >= max_depth){
+                return PARSE_DEPTH_EXCEEDED;
+            }
+            PROFILE_COUNT(PROFILE_PARSE_CONTAINER);
+            pos++;
+            parse_whitespace();
+            if(json[pos] == (ch == '[' ? ']' : '}')){
+                pos++;
+                tmp.set_null();
+                tmp.type = ch == '[' ? JSON_ARRAY : JSON_OBJECT;
+            }
+            else{
+                stack.push_back(Frame());
+                stack.back().is_object = ch == '{';
+                if(ch == '{' && (ret = parse_key(stack.back().key)) != PARSE_OK){
+                    return ret;
+                }
+                continue;
+            }
+        }
+        else if((ret = parse_scalar(tmp)) != PARSE_OK){
+            return ret;
+        }
+
+        /**********把值放入所在的容器，逐层关闭已结束的容器***************/
+        while(1){
+            if(stack.empty()){
+                v = std::move(tmp);
+                return PARSE_OK;
+            }
+            Frame &f = stack.back();
+            if(f.is_object){
+                f.members[std::move(f.key)] = std::move(tmp);
+            }
+            else{
+                f.items.push_back(std::move(tmp));
+            }
+            parse_whitespace();
+            if(json[pos] == ','){
+                pos++;
+                parse_whitespace();
+                if(f.is_object && (ret = parse_key(f.key)) != PARSE_OK){
+                    return ret;
+                }
+                break;
+            }
+            if(json[pos] != (f.is_object ? '}' : ']')){
+                return f.is_object ? PARSE_MISS_COMMA_OR_CURLY_BRACKET : PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+            }
+            pos++;
+            tmp.set_null();
+            if(f.is_object){
+                tmp.type = JSON_OBJECT;
+                tmp.object = new SharedObject(std::move(f.members));
+            }
+            else{
+                tmp.type = JSON_ARRAY;
+                tmp.array = new SharedArray(std::move(f.items));
+            }
+            stack.pop_back();
+        }
+    }
+}
+
+int Parser::parse_scalar(Value &v)
 {
     if(pos == json.length()){
         return PARSE_EXPECT_VALUE;
@@ -113,151 +499,103 @@ int Parser::parse_value(Value &v)
             return parse_literal(v, "true");
         case '\"':
             return parse_string(v);
-        case '[':
-            return parse_array(v);
-        case '{':
-            return parse_object(v);
         default:
             return parse_number(v);
     }
 }
 
-int Parser::parse_object(Value &v)
+// 对象中的键和其后的':'
+int Parser::parse_key(std::string &key)
 {
-    int ret;
-    pos++;
-    parse_whitespace();
-    if(json[pos] == '}'){
-        pos++;
-        v.type = JSON_OBJECT;
-        v.object = nullptr;
-        return PARSE_OK;
+    key.clear();
+    if(json[pos] != '\"'){
+        return PARSE_MISS_KEY;
     }
-    std::unordered_map<std::string, Value> tmp_object;
-    while(1){
-        std::string tmp_key;
-        Value tmp_value;
-
-
-       /**********Parse Key***************/
-        if(json[pos] != '\"'){
-            ret = PARSE_MISS_KEY;
-            break;
-        }   
-
-        int tmp = parse_string_raw(tmp_key);
-        if(tmp != PARSE_OK){
-            ret = PARSE_MISS_KEY;
-            break;
-        } 
-        parse_whitespace();
-        if(json[pos] != ':'){
-            ret = PARSE_MISS_COLON;
-            break;
-        }
-        pos++;
-        parse_whitespace();  
-        if((ret = parse_value(tmp_value)) != PARSE_OK){
-            break;
-        }
-
-        tmp_object[tmp_key] = tmp_value;
-
-        parse_whitespace(); 
-        if(json[pos] == ','){
-            pos++;
-            parse_whitespace();
-        }
-        else if(json[pos] ==  '}'){
-            pos++;
-            v.type = JSON_OBJECT;
-            v.object = new std::unordered_map<std::string, Value>(tmp_object);
-            ret = PARSE_OK;
-            break;
-        }
-        else{
-            ret = PARSE_MISS_COMMA_OR_CURLY_BRACKET;
-            break;
-        }
+    int ret = parse_string_raw(key);
+    if(ret != PARSE_OK){
+        return ret == PARSE_INVALID_UTF8 ? ret : PARSE_MISS_KEY;
     }
-    return ret;
+    parse_whitespace();
+    if(json[pos] != ':'){
+        return PARSE_MISS_COLON;
+    }
+    pos++;
+    parse_whitespace();
+    return PARSE_OK;
 }
 
-int Parser::parse_array(Value &v)
+int Parser::parse_number(Value &v)
 {
-    size_t size = 0;
-    int ret;
-    pos++;
-    parse_whitespace();
-    if(json[pos] == ']')
-    {
-        pos++;
-        v.type = JSON_ARRAY;
-        v.array = nullptr;
-        return PARSE_OK;
+    PROFILE_SCOPE(PROFILE_PARSE_NUMBER, pos);
+    size_t head = pos;
+    int ret = scan_number();
+    if(ret == PARSE_OK && raw_numbers){
+        v.set_raw_number(json.c_str() + head, pos - head);
+        return ret;
     }
-    std::vector<Value> tmp;
-    while(1)
-    {
-        Value e;
-        if((ret = parse_value(e)) != PARSE_OK)
-        {
-            break;
-        }
-        tmp.push_back(std::move(e)); 
-        parse_whitespace();
-        if(json[pos] == ','){
-            pos++;
-            parse_whitespace();
-        }
-        else if(json[pos] == ']'){
-            pos++;
-            v.type = JSON_ARRAY;
-            v.array = new std::vector<Value>(tmp);
-            return PARSE_OK;
-        }
-        else{
-            ret = PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
-            break;
-        }
+    if(ret != PARSE_OK || parse_integer(head, v)){
+        return ret;
+    }
+    double tmp;
+    ret = convert_number(head, tmp);
+    if(ret == PARSE_OK){
+        v.set_number(tmp);
     }
     return ret;
 }
 
-int Parser::parse_number(Value &v)
+int Parser::parse_number_raw(double &d)
 {
+    PROFILE_SCOPE(PROFILE_PARSE_NUMBER, pos);
     size_t head = pos;
-    if(json[pos] == '-'){
-        pos++;
+    int ret = scan_number();
+    if(ret != PARSE_OK){
+        return ret;
     }
-    if(json[pos] == '0'){
-        pos++;
+    return convert_number(head, d);
+}
+
+// [p, end)是语法正确的数字。没有小数和指数部分且在64位整数范围内时
+// 按整数保存并返回true；"-0"仍按double保存，以保留符号。Parser与Value::parse_raw_number共用
+static bool integer_value(const char *p, const char *end, Value &v)
+{
+    bool negative = *p == '-';
+    p += negative;
+    if(end - p > 20){
+        return false;
     }
-    else{
-        if(!ISDIGIT09(json[pos])){
-            return PARSE_INVALID_VALUE;         // 非数字
+    uint64_t u = 0;
+    for(; p != end; ++p){
+        if(*p < '0' || *p > '9'){
+            return false;
         }
-        for (pos++; ISDIGIT(json[pos]); pos++);
-    }
-
-    if(json[pos] == '.'){
-        pos++;
-        if(!ISDIGIT(json[pos])){
-            return PARSE_INVALID_VALUE;
+        unsigned digit = *p - '0';
+        if(u > (UINT64_MAX - digit) / 10){
+            return false;
         }
-        for(pos++; ISDIGIT(json[pos]); pos++);
+        u = u * 10 + digit;
     }
-
-    if(json[pos] == 'e' || json[pos] == 'E'){
-        pos++;
-        if(json[pos] == '+' || json[pos] == '-'){
-            pos++;
-        }
-        if(!ISDIGIT(json[pos])){
-            return PARSE_INVALID_VALUE;
-        }
-        for (pos++; ISDIGIT(json[pos]); pos++);
+    if(!negative){
+        v.set_uint64(u);
+    }
+    else if(u == 0 || u > (uint64_t)INT64_MAX + 1){
+        return false;
     }
+    else{
+        v.set_int64(u == (uint64_t)INT64_MAX + 1 ? INT64_MIN : -(int64_t)u);
+    }
+    return true;
+}
+
+// [head, pos)是已通过scan_number的数字
+bool Parser::parse_integer(size_t head, Value &v)
+{
+    return integer_value(json.c_str() + head, json.c_str() + pos, v);
+}
+
+// 把[head, pos)的数字转换为double
+int Parser::convert_number(size_t head, double &d)
+{
     size_t size = pos - head;
     errno = 0;
     double tmp;
@@ -269,7 +607,44 @@ int Parser::parse_number(Value &v)
         return PARSE_NUMBER_TOO_BIG;
     }
 
-    v.set_number(tmp);
+    d = tmp;
+    return PARSE_OK;
+}
+
+// 只检查数字语法并移动pos，不做转换
+int Parser::scan_number()
+{
+    if(json[pos] == '-'){
+        pos++;
+    }
+    if(json[pos] == '0'){
+        pos++;
+    }
+    else{
+        if(!ISDIGIT09(json[pos])){
+            return PARSE_INVALID_VALUE;         // 非数字
+        }
+        for (pos++; ISDIGIT(json[pos]); pos++);
+    }
+
+    if(json[pos] == '.'){
+        pos++;
+        if(!ISDIGIT(json[pos])){
+            return PARSE_INVALID_VALUE;
+        }
+        for(pos++; ISDIGIT(json[pos]); pos++);
+    }
+
+    if(json[pos] == 'e' || json[pos] == 'E'){
+        pos++;
+        if(json[pos] == '+' || json[pos] == '-'){
+            pos++;
+        }
+        if(!ISDIGIT(json[pos])){
+            return PARSE_INVALID_VALUE;
+        }
+        for (pos++; ISDIGIT(json[pos]); pos++);
+    }
     return PARSE_OK;
 }
 
@@ -301,7 +676,7 @@ int Parser::parse_literal(Value &v, const std::string &s)
 #define STRING_ERROR(ret) \
     do                    \
     {                     \
-        buf.pop(len);     \
+        buf.top = head;   \
         return ret;       \
     }while(0)
 
@@ -317,13 +692,32 @@ int Parser::parse_string(Value &v)
 
 int Parser::parse_string_raw(std::string &s)
 {
+    PROFILE_SCOPE(PROFILE_PARSE_STRING, pos);
     unsigned u;
     unsigned u2;
+    const char *p = json.c_str();
     pos++;
     size_t head = buf.top;
     size_t len = 0;
     while(1){
-        char ch = json[pos++];
+        // 不需要转义的字符整段复制；check_utf8时非ASCII字节也停下来逐个序列检查
+        const char *run = p + pos;
+        len = scan_string_chars(run, check_utf8) - run;
+        if(len != 0){
+            buf.put_string(run, len);
+            pos += len;
+        }
+        char ch = p[pos++];
+        if(check_utf8 && (unsigned char)ch >= 0x80){
+            len = utf8_sequence_length((const unsigned char *)p + pos - 1);
+            if(len == 0){
+                pos--;
+                STRING_ERROR(PARSE_INVALID_UTF8);
+            }
+            buf.put_string(p + pos - 1, len);
+            pos += len - 1;
+            continue;
+        }
         switch(ch)
         {
             case '\"':
@@ -331,8 +725,8 @@ int Parser::parse_string_raw(std::string &s)
                 s.append((char*)buf.pop(len), len);
                 return PARSE_OK;
             case '\0':
-                buf.top = head;
-                return PARSE_MISS_QUOTATION_MARK;
+                pos--;
+                STRING_ERROR(PARSE_MISS_QUOTATION_MARK);
             case '\\':
                 switch(json[pos++])
                 {
@@ -395,164 +789,3011 @@ int Parser::parse_string_raw(std::string &s)
     }
 }
 
-void Parser::encode_utf8(unsigned u)
+void Parser::encode_utf8(unsigned u)
+{
+    if(u <= 0x007F){
+        buf.put_char(u & 0xFF);
+    }
+    else if(u <= 0x7FF){
+        buf.put_char(0xC0 | (u >> 6) & 0xFF);
+        buf.put_char(0x80 | u & 0x3F);
+    }
+    else if(u <= 0xFFFF){
+        buf.put_char(0xE0 | ((u >> 12) & 0xFF));
+        buf.put_char(0x80 | ((u >> 6) & 0x3F));
+        buf.put_char(0x80 | u & 0x3F);
+    }
+    else{
+        assert(u <= 0x10FFFF);
+        buf.put_char(0xF0 | (u >> 18) & 0xFF);
+        buf.put_char(0x80 | (u >> 12) & 0x3F);
+        buf.put_char(0x80 | (u >> 6) & 0x3F);
+        buf.put_char(0x80 | u & 0x3F);
+    }
+}
+
+bool Parser::parse_hex4(unsigned &u)
+{
+    u = 0;
+    for (int i = 0; i != 4; ++i){
+        char ch = json[pos++];
+        u <<= 4;
+        if(ch >= '0' && ch <= '9'){
+            u |= (ch - '0');
+        }
+        else if(ch >= 'A' && ch <= 'F'){
+            u |= (ch - 'A' + 10);
+        }
+        else if(ch >= 'a' && ch <= 'f'){
+            u |= (ch - 'a' + 10);
+        }
+        else{
+            return false;
+        }
+    }
+    return true;
+}
+
+/**********************************************************
+ *                                                        *
+ *                                                        *
+ *               Parser: skip & projection                *
+ *                                                        *
+ *                                                        *
+ * ********************************************************/
+
+// 以下skip_*与parse_*遵循相同的语法和错误码，但不解码字符串、不转换数字，
+// 也不向Buffer写入任何内容。
+// 与parse_value相同，用显式的栈代替递归。栈中每层只需记录是数组还是对象，
+// 4096层以内使用栈上的位图，不分配内存
+int Parser::skip_value()
+{
+    uint64_t inline_bits[64];
+    std::vector<uint64_t> heap_bits;
+    uint64_t *bits = inline_bits;
+    size_t words = 64;
+    size_t depth = 0;
+    int ret;
+    while(1){
+        char ch = json[pos];
+        if(ch == '[' || ch == '{'){
+            if(depth >= max_depth){
+                return PARSE_DEPTH_EXCEEDED;
+            }
+            if(depth / 64 == words){
+                if(bits == inline_bits){
+                    heap_bits.assign(inline_bits, inline_bits + 64);
+                }
+                words *= 2;
+                heap_bits.resize(words);
+                bits = heap_bits.data();
+            }
+            uint64_t mask = (uint64_t)1 << (depth % 64);
+            bits[depth / 64] = ch == '{' ? bits[depth / 64] | mask : bits[depth / 64] & ~mask;
+            depth++;
+            pos++;
+            parse_whitespace();
+            if(json[pos] == (ch == '[' ? ']' : '}')){
+                pos++;
+                depth--;
+            }
+            else{
+                if(ch == '{' && (ret = skip_key()) != PARSE_OK){
+                    return ret;
+                }
+                continue;
+            }
+        }
+        else if((ret = skip_scalar()) != PARSE_OK){
+            return ret;
+        }
+
+        while(1){
+            if(depth == 0){
+                return PARSE_OK;
+            }
+            bool is_object = (bits[(depth - 1) / 64] >> ((depth - 1) % 64)) & 1;
+            parse_whitespace();
+            if(json[pos] == ','){
+                pos++;
+                parse_whitespace();
+                if(is_object && (ret = skip_key()) != PARSE_OK){
+                    return ret;
+                }
+                break;
+            }
+            if(json[pos] != (is_object ? '}' : ']')){
+                return is_object ? PARSE_MISS_COMMA_OR_CURLY_BRACKET : PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+            }
+            pos++;
+            depth--;
+        }
+    }
+}
+
+int Parser::skip_scalar()
+{
+    switch(json[pos])
+    {
+        case '\0':
+            return pos == json.length() ? PARSE_EXPECT_VALUE : PARSE_INVALID_VALUE;
+        case 'n':
+            if(json.compare(pos, 4, "null") != 0) return PARSE_INVALID_VALUE;
+            pos += 4;
+            return PARSE_OK;
+        case 'f':
+            if(json.compare(pos, 5, "false") != 0) return PARSE_INVALID_VALUE;
+            pos += 5;
+            return PARSE_OK;
+        case 't':
+            if(json.compare(pos, 4, "true") != 0) return PARSE_INVALID_VALUE;
+            pos += 4;
+            return PARSE_OK;
+        case '\"':
+            return skip_string();
+        default:
+            return skip_number();
+    }
+}
+
+int Parser::skip_key()
+{
+    if(json[pos] != '\"'){
+        return PARSE_MISS_KEY;
+    }
+    int ret = skip_string();
+    if(ret != PARSE_OK){
+        return ret == PARSE_INVALID_UTF8 ? ret : PARSE_MISS_KEY;
+    }
+    parse_whitespace();
+    if(json[pos] != ':'){
+        return PARSE_MISS_COLON;
+    }
+    pos++;
+    parse_whitespace();
+    return PARSE_OK;
+}
+
+int Parser::skip_number()
+{
+    size_t head = pos;
+    int ret = scan_number();
+    if(ret != PARSE_OK || !check_number_range){
+        return ret;
+    }
+    // 没有指数且整数部分不超过308位的数字不可能越界，不必转换
+    size_t len = pos - head;
+    if(len <= 308 && memchr(json.data() + head, 'e', len) == nullptr
+                  && memchr(json.data() + head, 'E', len) == nullptr){
+        return PARSE_OK;
+    }
+    errno = 0;
+    double tmp = strtod(json.c_str() + head, nullptr);
+    if(errno == ERANGE && (tmp == HUGE_VAL || tmp == -HUGE_VAL)){
+        return PARSE_NUMBER_TOO_BIG;
+    }
+    return PARSE_OK;
+}
+
+int Parser::skip_string()
+{
+    unsigned u;
+    unsigned u2;
+    const char *p = json.c_str();
+    pos++;
+    while(1){
+        pos = scan_string_chars(p + pos, check_utf8) - p;
+        char ch = p[pos++];
+        if(check_utf8 && (unsigned char)ch >= 0x80){
+            size_t n = utf8_sequence_length((const unsigned char *)p + pos - 1);
+            if(n == 0){
+                pos--;
+                return PARSE_INVALID_UTF8;
+            }
+            pos += n - 1;
+            continue;
+        }
+        switch(ch)
+        {
+            case '\"':
+                return PARSE_OK;
+            case '\0':
+                pos--;
+                return PARSE_MISS_QUOTATION_MARK;
+            case '\\':
+                switch(p[pos++])
+                {
+                    case '\\': case '/': case 'b': case 'f':
+                    case 'n':  case 'r': case 't': case '\"':
+                        break;
+                    case 'u':
+                        if(!parse_hex4(u)){
+                            return PARSE_INVALID_UNICODE_HEX;
+                        }
+                        if(u >= 0xD800 && u <= 0xDBFF){
+                            if(p[pos++] != '\\' || p[pos++] != 'u'){
+                                return PARSE_INVALID_UNICODE_SURROGATE;
+                            }
+                            if(!parse_hex4(u2)){
+                                return PARSE_INVALID_UNICODE_HEX;
+                            }
+                            if(u2 < 0xDC00 || u2 > 0xDFFF){
+                                return PARSE_INVALID_UNICODE_SURROGATE;
+                            }
+                        }
+                        break;
+                    default:
+                        return PARSE_INVALID_STRING_ESCAPE;
+                }
+                break;
+            default:
+                return PARSE_INVALID_STRING_CHAR;
+        }
+    }
+}
+
+int Parser::select_value(const Projection &p, int node, std::vector<Value> &values, std::vector<bool> &found)
+{
+    const Projection::Node &n = p.nodes[node];
+    if(n.slot >= 0){
+        // 命中路径：完整解析该子树，更深的路径直接从结果中取
+        int ret = parse_value(values[n.slot]);
+        if(ret == PARSE_OK){
+            found[n.slot] = true;
+            select_from(p, node, values[n.slot], values, found);
+        }
+        return ret;
+    }
+    if(n.children.empty()){
+        return skip_value();
+    }
+    switch(json[pos])
+    {
+        case '[':
+            return select_array(p, node, values, found);
+        case '{':
+            return select_object(p, node, values, found);
+        default:
+            return skip_value();
+    }
+}
+
+int Parser::select_array(const Projection &p, int node, std::vector<Value> &values, std::vector<bool> &found)
+{
+    int ret;
+    size_t index = 0;
+    pos++;
+    parse_whitespace();
+    if(json[pos] == ']'){
+        pos++;
+        return PARSE_OK;
+    }
+    while(1){
+        int child = p.find_child(node, index++);
+        ret = child < 0 ? skip_value() : select_value(p, child, values, found);
+        if(ret != PARSE_OK){
+            return ret;
+        }
+        parse_whitespace();
+        if(json[pos] == ','){
+            pos++;
+            parse_whitespace();
+        }
+        else if(json[pos] == ']'){
+            pos++;
+            return PARSE_OK;
+        }
+        else{
+            return PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+        }
+    }
+}
+
+int Parser::select_object(const Projection &p, int node, std::vector<Value> &values, std::vector<bool> &found)
+{
+    int ret;
+    pos++;
+    parse_whitespace();
+    if(json[pos] == '}'){
+        pos++;
+        return PARSE_OK;
+    }
+    while(1){
+        /**********Match Key***************/
+        if(json[pos] != '\"'){
+            return PARSE_MISS_KEY;
+        }
+        size_t head = pos + 1;
+        if(skip_string() != PARSE_OK){
+            return PARSE_MISS_KEY;
+        }
+        size_t len = pos - 1 - head;
+        int child;
+        if(memchr(json.data() + head, '\\', len) == nullptr){
+            child = p.find_child(node, json.data() + head, len);
+        }
+        else{
+            // 带转义的键较少见，此时才解码
+            std::string key;
+            size_t end = pos;
+            pos = head - 1;
+            parse_string_raw(key);
+            pos = end;
+            child = p.find_child(node, key.data(), key.length());
+        }
+
+        parse_whitespace();
+        if(json[pos] != ':'){
+            return PARSE_MISS_COLON;
+        }
+        pos++;
+        parse_whitespace();
+        ret = child < 0 ? skip_value() : select_value(p, child, values, found);
+        if(ret != PARSE_OK){
+            return ret;
+        }
+        parse_whitespace();
+        if(json[pos] == ','){
+            pos++;
+            parse_whitespace();
+        }
+        else if(json[pos] == '}'){
+            pos++;
+            return PARSE_OK;
+        }
+        else{
+            return PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+        }
+    }
+}
+
+// 路径互为前缀时(如"/a"与"/a/b")，较深的路径从已解析的Value中提取
+void Parser::select_from(const Projection &p, int node, const Value &v, std::vector<Value> &values, std::vector<bool> &found)
+{
+    const Projection::Node &n = p.nodes[node];
+    for(size_t i = 0; i != n.children.size(); ++i){
+        const Value *child = nullptr;
+        if(v.type == JSON_OBJECT && v.object){
+            auto iter = v.object->data.find(n.children[i].first);
+            if(iter != v.object->data.end()){
+                child = &iter->second;
+            }
+        }
+        else if(v.type == JSON_ARRAY && v.array && n.indexes[i] >= 0
+                && (size_t)n.indexes[i] < v.array->data.size()){
+            child = &v.array->data[n.indexes[i]];
+        }
+        if(child == nullptr){
+            continue;
+        }
+        int c = n.children[i].second;
+        if(p.nodes[c].slot >= 0){
+            values[p.nodes[c].slot] = *child;
+            found[p.nodes[c].slot] = true;
+        }
+        select_from(p, c, *child, values, found);
+    }
+}
+
+/**********************************************************
+ *                                                        *
+ *                                                        *
+ *                       Reader                           *
+ *                                                        *
+ *                                                        *
+ * ********************************************************/
+
+// 每个读取函数结束时都跳过其后的空白
+int Reader::peek()
+{
+    switch(parser.json[parser.pos])
+    {
+        case 'n':  return JSON_NULL;
+        case 't':  return JSON_TRUE;
+        case 'f':  return JSON_FALSE;
+        case '\"': return JSON_STRING;
+        case '[':  return JSON_ARRAY;
+        case '{':  return JSON_OBJECT;
+        case '\0':
+            if(parser.pos == parser.json.length()){
+                return -1;
+            }
+            return JSON_NUMBER;
+        default:
+            return JSON_NUMBER;
+    }
+}
+
+int Reader::read_null()
+{
+    if(peek() != JSON_NULL){
+        return PARSE_TYPE_MISMATCH;
+    }
+    Value tmp;
+    int ret = parser.parse_literal(tmp, "null");
+    parser.parse_whitespace();
+    return ret;
+}
+
+int Reader::read(bool &b)
+{
+    int type = peek();
+    if(type != JSON_TRUE && type != JSON_FALSE){
+        return PARSE_TYPE_MISMATCH;
+    }
+    Value tmp;
+    int ret = parser.parse_literal(tmp, type == JSON_TRUE ? "true" : "false");
+    if(ret == PARSE_OK){
+        b = type == JSON_TRUE;
+    }
+    parser.parse_whitespace();
+    return ret;
+}
+
+int Reader::read(double &d)
+{
+    if(peek() != JSON_NUMBER){
+        return PARSE_TYPE_MISMATCH;
+    }
+    int ret = parser.parse_number_raw(d);
+    parser.parse_whitespace();
+    return ret;
+}
+
+// 整数值(包括1.0、1e3这样写法的)的数字转换为64位整数，不是整数或超出范围时返回PARSE_TYPE_MISMATCH
+int Reader::read(int64_t &i)
+{
+    if(peek() != JSON_NUMBER){
+        return PARSE_TYPE_MISMATCH;
+    }
+    Value tmp;
+    int ret = parser.parse_number(tmp);
+    parser.parse_whitespace();
+    if(ret != PARSE_OK){
+        return ret;
+    }
+    if(tmp.is_int64()){
+        i = tmp.get_int64();
+        return PARSE_OK;
+    }
+    double d = tmp.get_number();
+    if(tmp.is_uint64() || d != std::floor(d) || d < -9223372036854775808.0 || d >= 9223372036854775808.0){
+        return PARSE_TYPE_MISMATCH;
+    }
+    i = (int64_t)d;
+    return PARSE_OK;
+}
+
+int Reader::read(uint64_t &u)
+{
+    if(peek() != JSON_NUMBER){
+        return PARSE_TYPE_MISMATCH;
+    }
+    Value tmp;
+    int ret = parser.parse_number(tmp);
+    parser.parse_whitespace();
+    if(ret != PARSE_OK){
+        return ret;
+    }
+    if(tmp.is_uint64()){
+        u = tmp.get_uint64();
+        return PARSE_OK;
+    }
+    double d = tmp.get_number();
+    if(tmp.is_int64() || d != std::floor(d) || d < 0 || d >= 18446744073709551616.0){
+        return PARSE_TYPE_MISMATCH;
+    }
+    u = (uint64_t)d;
+    return PARSE_OK;
+}
+
+int Reader::read(std::string &s)
+{
+    if(peek() != JSON_STRING){
+        return PARSE_TYPE_MISMATCH;
+    }
+    s.clear();
+    int ret = parser.parse_string_raw(s);
+    parser.parse_whitespace();
+    return ret;
+}
+
+int Reader::read(Value &v)
+{
+    v.set_null();
+    int ret = parser.parse_value(v);
+    parser.parse_whitespace();
+    return ret;
+}
+
+int Reader::skip()
+{
+    int ret = parser.skip_value();
+    parser.parse_whitespace();
+    return ret;
+}
+
+int Reader::begin_array()
+{
+    if(peek() != JSON_ARRAY){
+        return PARSE_TYPE_MISMATCH;
+    }
+    parser.pos++;
+    parser.parse_whitespace();
+    return PARSE_OK;
+}
+
+int Reader::array_next(size_t index, bool &more)
+{
+    char ch = parser.json[parser.pos];
+    more = true;
+    if(ch == ']'){
+        more = false;
+    }
+    else if(index == 0){
+        return PARSE_OK;
+    }
+    else if(ch != ','){
+        return PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+    }
+    parser.pos++;
+    parser.parse_whitespace();
+    return PARSE_OK;
+}
+
+int Reader::begin_object()
+{
+    if(peek() != JSON_OBJECT){
+        return PARSE_TYPE_MISMATCH;
+    }
+    parser.pos++;
+    parser.parse_whitespace();
+    return PARSE_OK;
+}
+
+// 处理'}'或','，停在键的'"'上
+int Reader::next_key(size_t index, bool &more)
+{
+    char ch = parser.json[parser.pos];
+    more = true;
+    if(ch == '}'){
+        more = false;
+        parser.pos++;
+        parser.parse_whitespace();
+        return PARSE_OK;
+    }
+    if(index != 0){
+        if(ch != ','){
+            return PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+        }
+        parser.pos++;
+        parser.parse_whitespace();
+    }
+    return parser.json[parser.pos] == '\"' ? PARSE_OK : PARSE_MISS_KEY;
+}
+
+// 键之后的':'
+int Reader::after_key()
+{
+    parser.parse_whitespace();
+    if(parser.json[parser.pos] != ':'){
+        return PARSE_MISS_COLON;
+    }
+    parser.pos++;
+    parser.parse_whitespace();
+    return PARSE_OK;
+}
+
+int Reader::object_next(size_t index, std::string &key, bool &more)
+{
+    int ret = next_key(index, more);
+    if(ret != PARSE_OK || !more){
+        return ret;
+    }
+    key.clear();
+    if(parser.parse_string_raw(key) != PARSE_OK){
+        return PARSE_MISS_KEY;
+    }
+    return after_key();
+}
+
+int Reader::object_next(size_t index, const KeySet &keys, int &id, bool &more)
+{
+    int ret = next_key(index, more);
+    if(ret != PARSE_OK || !more){
+        return ret;
+    }
+    const char *p = parser.json.c_str() + parser.pos + 1;
+    const char *end = scan_string_chars(p, false);
+    if(*end == '\"'){
+        // 没有转义，直接在输入上查找
+        id = keys.lookup(p, end - p);
+        parser.pos = end + 1 - parser.json.c_str();
+    }
+    else{
+        std::string key;
+        if(parser.parse_string_raw(key) != PARSE_OK){
+            return PARSE_MISS_KEY;
+        }
+        id = keys.lookup(key);
+    }
+    return after_key();
+}
+
+int Reader::finish()
+{
+    return parser.pos == parser.json.length() ? PARSE_OK : PARSE_ROOT_NOT_SINGULAR;
+}
+
+
+/**********************************************************
+ *                                                        *
+ *                                                        *
+ *                     Formatter                          *
+ *                                                        *
+ *                                                        *
+ * ********************************************************/
+
+// Json_Minify/Json_Pretty直接处理JSON文本，不做解析和校验。
+// 字符串整段拷贝，其中的'{'、','、':'等不会被当作结构字符。
+
+// 返回p之后第一个等于c0~c4或NUL的字符位置，p所在的字符串必须以NUL结尾
+NO_SANITIZE_ADDRESS
+static const char *scan_until(const char *p, char c0, char c1, char c2, char c3, char c4)
+{
+#if defined(__SSE2__)
+    for(; ((uintptr_t)p & 15) != 0; ++p){
+        if(*p == c0 || *p == c1 || *p == c2 || *p == c3 || *p == c4 || *p == '\0'){
+            return p;
+        }
+    }
+    const __m128i v0 = _mm_set1_epi8(c0);
+    const __m128i v1 = _mm_set1_epi8(c1);
+    const __m128i v2 = _mm_set1_epi8(c2);
+    const __m128i v3 = _mm_set1_epi8(c3);
+    const __m128i v4 = _mm_set1_epi8(c4);
+    const __m128i zero = _mm_setzero_si128();
+    for(;; p += 16){
+        __m128i x = _mm_load_si128((const __m128i *)p);
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, v0), _mm_cmpeq_epi8(x, v1)),
+                                   _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, v2), _mm_cmpeq_epi8(x, v3)),
+                                                _mm_or_si128(_mm_cmpeq_epi8(x, v4), _mm_cmpeq_epi8(x, zero))));
+        int mask = _mm_movemask_epi8(hit);
+        if(mask != 0){
+            return p + __builtin_ctz(mask);
+        }
+    }
+#else
+    for(;; ++p){
+        if(*p == c0 || *p == c1 || *p == c2 || *p == c3 || *p == c4 || *p == '\0'){
+            return p;
+        }
+    }
+#endif
+}
+
+// p指向字符串开头的'"'，返回结尾'"'之后的位置；字符串未结束时返回end
+static const char *skip_string_text(const char *p, const char *end)
+{
+    for(++p; ; ){
+        p = scan_until(p, '\"', '\\', '\"', '\"', '\"');
+        if(p >= end){
+            return end;
+        }
+        if(*p == '\"'){
+            return p + 1;
+        }
+        if(*p == '\\' && p + 1 != end){
+            p += 2;
+        }
+        else{
+            p++;        // 字符串中间的NUL或末尾孤立的'\\'
+        }
+    }
+}
+
+static inline bool is_whitespace(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+}
+
+static inline void put_newline(std::string &out, size_t depth, const FormatOptions &options)
+{
+    if(options.indent != 0){
+        out += options.newline;
+        out.append(depth * options.indent, options.indent_char);
+    }
+}
+
+void Json_Minify(std::string &out, const std::string &json)
+{
+    const char *p = json.c_str();
+    const char *end = p + json.length();
+    size_t head = out.length();
+    out.resize(head + json.length());   // 输出不会比输入长
+    char *o = &out[0] + head;
+    while(p < end){
+        const char *q = scan_until(p, ' ', '\n', '\r', '\t', '\"');
+        if(q > p){
+            memcpy(o, p, q - p);
+            o += q - p;
+            p = q;
+        }
+        if(p >= end){
+            break;
+        }
+        switch(*p)
+        {
+            case '\"':
+                q = skip_string_text(p, end);
+                memcpy(o, p, q - p);
+                o += q - p;
+                p = q;
+                break;
+            case ' ':
+            case '\n':
+            case '\r':
+            case '\t':
+                p++;
+                break;
+            default:
+                *o++ = *p++;    // 文本中间的NUL
+                break;
+        }
+    }
+    out.resize(o - out.data());
+}
+
+void Json_Pretty(std::string &out, const std::string &json, const FormatOptions &options)
+{
+    const char *p = json.c_str();
+    const char *end = p + json.length();
+    const char *q;
+    size_t depth = 0;
+    out.reserve(out.length() + json.length() * 2);
+    while(p < end){
+        switch(*p)
+        {
+            case ' ':
+            case '\t':
+            case '\n':
+            case '\r':
+                p++;
+                break;
+            case '\"':
+                q = skip_string_text(p, end);
+                out.append(p, q - p);
+                p = q;
+                break;
+            case '{':
+            case '[':
+                // 空容器保持在一行
+                for(q = p + 1; q < end && is_whitespace(*q); ++q);
+                if(q < end && (*q == '}' || *q == ']')){
+                    out += *p;
+                    out += *q;
+                    p = q + 1;
+                    break;
+                }
+                out += *p++;
+                put_newline(out, ++depth, options);
+                break;
+            case '}':
+            case ']':
+                if(depth > 0){
+                    depth--;
+                }
+                put_newline(out, depth, options);
+                out += *p++;
+                break;
+            case ',':
+                out += *p++;
+                if(options.indent == 0 && options.space_after_comma){
+                    out += ' ';
+                }
+                put_newline(out, depth, options);
+                break;
+            case ':':
+                out += *p++;
+                if(options.space_after_colon){
+                    out += ' ';
+                }
+                break;
+            default:
+                // 数字、字面量等，整段拷贝
+                for(q = p + 1; q < end && !is_whitespace(*q) && *q != ',' && *q != ':' && *q != '\"'
+                               && *q != '{' && *q != '}' && *q != '[' && *q != ']'; ++q);
+                out.append(p, q - p);
+                p = q;
+                break;
+        }
+    }
+}
+
+/**********************************************************
+ *                                                        *
+ *                                                        *
+ *                     Generator                          *
+ *                                                        *
+ *                                                        *
+ * ********************************************************/
+// 64位FNV-1a，Value::hash与输出片段的键共用
+static uint64_t hash_bytes(const char *s, size_t len, uint64_t h)
+{
+    for(size_t i = 0; i != len; ++i){
+        h = (h ^ (unsigned char)s[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+// splitmix64的最终混合，使相近的输入得到差别很大的结果
+static uint64_t hash_mix(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBull;
+    h ^= h >> 31;
+    return h;
+}
+
+// 返回[p, end)中第一个需要转义的字符('"'、'\\'、控制字符)的位置，没有时返回end；
+// stop_non_ascii为真时也停在>=0x80的字节上。不越过end读取，不要求结尾有NUL
+static const char *scan_plain_chars(const char *p, const char *end, bool stop_non_ascii)
+{
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('\"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    for(; end - p >= 16; p += 16){
+        __m128i x = _mm_loadu_si128((const __m128i *)p);
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash)),
+                                   _mm_cmpeq_epi8(_mm_min_epu8(x, control), x));
+        int mask = _mm_movemask_epi8(hit);
+        if(stop_non_ascii){
+            mask |= _mm_movemask_epi8(x);
+        }
+        if(mask != 0){
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for(; p != end; ++p){
+        unsigned char ch = (unsigned char)*p;
+        if(ch < 0x20 || ch == '\"' || ch == '\\' || (stop_non_ascii && ch >= 0x80)){
+            break;
+        }
+    }
+    return p;
+}
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+// 输出\uXXXX，返回写入后的位置
+static char *put_u4(char *p, unsigned u)
+{
+    *p++ = '\\';
+    *p++ = 'u';
+    *p++ = hex_digits[(u >> 12) & 15];
+    *p++ = hex_digits[(u >> 8) & 15];
+    *p++ = hex_digits[(u >> 4) & 15];
+    *p++ = hex_digits[u & 15];
+    return p;
+}
+
+// 解码长度为n的合法UTF-8序列
+static unsigned decode_utf8(const unsigned char *p, size_t n)
+{
+    switch(n){
+        case 2:  return ((p[0] & 0x1Fu) << 6) | (p[1] & 0x3Fu);
+        case 3:  return ((p[0] & 0x0Fu) << 12) | ((p[1] & 0x3Fu) << 6) | (p[2] & 0x3Fu);
+        default: return ((p[0] & 0x07u) << 18) | ((p[1] & 0x3Fu) << 12) | ((p[2] & 0x3Fu) << 6) | (p[3] & 0x3Fu);
+    }
+}
+
+// Generator与Emitter共用的字符串转义和数字格式化。
+// invalid_utf8不为UTF8_KEEP时检查UTF-8编码，UTF8_VALIDATE遇到非法序列时不输出任何内容。
+// ensure_ascii时非ASCII字符输出为\uXXXX(BMP以外为代理对)，非法字节除UTF8_VALIDATE外都输出为\uFFFD。
+// 每个输入字节最多输出6字节(4字节序列输出12字节)
+static int put_escaped(Buffer &buf, const char *s, size_t len, utf8_handling invalid_utf8 = UTF8_KEEP,
+                       bool ensure_ascii = false)
+{
+    char *head;
+    char *p;
+    size_t size = len * 6 + 2;
+    const char *end = s + len;
+    bool check = invalid_utf8 != UTF8_KEEP || ensure_ascii;
+    p = head = (char*)buf.push(size);
+    *p++ = '"';
+    while(1)
+    {
+        const char *run = scan_plain_chars(s, end, check);
+        memcpy(p, s, run - s);
+        p += run - s;
+        s = run;
+        if(s == end){
+            break;
+        }
+        unsigned char ch = (unsigned char)*s++;
+        switch(ch){
+            case '\"': *p++ = '\\'; *p++ = '\"'; break;
+            case '\\': *p++ = '\\'; *p++ = '\\'; break;
+            case '\b': *p++ = '\\'; *p++ = 'b';  break;
+            case '\f': *p++ = '\\'; *p++ = 'f';  break;
+            case '\n': *p++ = '\\'; *p++ = 'n';  break;
+            case '\r': *p++ = '\\'; *p++ = 'r';  break;
+            case '\t': *p++ = '\\'; *p++ = 't';  break;
+            default:
+                if(ch < 0x20){
+                    p = put_u4(p, ch);
+                    break;
+                }
+                // 非ASCII字节：序列可能在end之前被截断，不足4字节时先复制到以0填充的临时区再检查
+                unsigned char tmp[4] = {0, 0, 0, 0};
+                const unsigned char *seq = (const unsigned char *)s - 1;
+                if(end - (const char *)seq < 4){
+                    memcpy(tmp, seq, end - (const char *)seq);
+                    seq = tmp;
+                }
+                size_t n = utf8_sequence_length(seq);
+                if(n != 0 && ensure_ascii){
+                    unsigned u = decode_utf8(seq, n);
+                    if(u >= 0x10000){
+                        u -= 0x10000;
+                        p = put_u4(p, 0xD800 + (u >> 10));
+                        u = 0xDC00 + (u & 0x3FF);
+                    }
+                    p = put_u4(p, u);
+                    s += n - 1;
+                }
+                else if(n != 0){
+                    memcpy(p, s - 1, n);
+                    p += n;
+                    s += n - 1;
+                }
+                else if(invalid_utf8 != UTF8_VALIDATE && ensure_ascii){
+                    p = put_u4(p, 0xFFFD);
+                }
+                else if(invalid_utf8 == UTF8_REPLACE){
+                    *p++ = (char)0xEF;
+                    *p++ = (char)0xBF;
+                    *p++ = (char)0xBD;
+                }
+                else{
+                    buf.pop(size);
+                    return GENERATE_INVALID_UTF8;
+                }
+        }
+    }
+    *p++ = '"';
+    buf.pop(size - (p - head));
+    return GENERATE_OK;
+}
+
+static void put_number(Buffer &buf, double n)
+{
+    char *tmp_buffer = (char*)buf.push(32);
+    size_t tmp_length = sprintf(tmp_buffer, "%.17g", n);
+    buf.pop(32 - tmp_length);
+}
+
+// 整数从低位起每次转换两位
+static void put_uint64(Buffer &buf, uint64_t u, bool negative = false)
+{
+    static const char digits[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+    while(u >= 100){
+        p -= 2;
+        memcpy(p, digits + (u % 100) * 2, 2);
+        u /= 100;
+    }
+    if(u >= 10){
+        p -= 2;
+        memcpy(p, digits + u * 2, 2);
+    }
+    else{
+        *--p = (char)('0' + u);
+    }
+    if(negative){
+        *--p = '-';
+    }
+    buf.put_string(p, tmp + sizeof(tmp) - p);
+}
+
+static void put_int64(Buffer &buf, int64_t i)
+{
+    put_uint64(buf, i < 0 ? 0 - (uint64_t)i : (uint64_t)i, i < 0);
+}
+
+static void put_number(Buffer &buf, const Value &v)
+{
+    if(v.is_raw_number()){
+        const std::string &s = v.get_raw_number();
+        buf.put_string(s.data(), s.length());
+    }
+    else if(v.is_int64()){
+        put_int64(buf, v.get_int64());
+    }
+    else if(v.is_uint64()){
+        put_uint64(buf, v.get_uint64());
+    }
+    else{
+        put_number(buf, v.get_number());
+    }
+}
+
+int Generator::run(const Value &v)
+{
+    PROFILE_CALL(PROFILE_GENERATE, buf.top);
+    int ret = stringify_value(v, 0);
+    if(ret != GENERATE_OK)
+    {
+        buf.clear();
+        return ret;
+    }
+    json.append(buf.stack, buf.top);
+    return GENERATE_OK;
+}
+
+
+// 不在C栈上递归：正在输出的数组/对象保存在显式的栈中，任意深的Value都不会栈溢出
+int Generator::stringify_value(const Value &root, size_t depth)
+{
+    struct Frame{
+        const Value *node;
+        size_t count;                                                       // 已输出的元素个数
+        std::unordered_map<std::string, Value>::const_iterator iter;        // 对象中下一个键值对
+        size_t head;                                                        // 在buf中的起始位置
+        bool cacheable;                                                     // 子树中没有exposed的节点，片段不需要stamp
+    };
+    std::vector<Frame> stack;
+    const Value *v = &root;
+    while(1){
+        /**********输出一个值；非空的容器只输出开头并入栈***************/
+        switch(v->type)
+        {
+            case JSON_NULL:
+                buf.put_string("null", 4);
+                break;
+            case JSON_FALSE:
+                buf.put_string("false", 5);
+                break;
+            case JSON_TRUE:
+                buf.put_string("true", 4);
+                break;
+            case JSON_NUMBER:{
+                PROFILE_SCOPE(PROFILE_STRINGIFY_NUMBER, buf.top);
+                put_number(buf, *v);
+                break;
+            }
+            case JSON_STRING:{
+                int ret = stringify_string(v->str->data);
+                if(ret != GENERATE_OK){
+                    return ret;
+                }
+                break;
+            }
+            case JSON_RAW:
+                // set_raw_json(json, false)可以存入空的片段
+                if(!v->str->data.empty()){
+                    buf.put_string(v->str->data.data(), v->str->data.length());
+                }
+                break;
+            case JSON_ARRAY:
+            case JSON_OBJECT:{
+                PROFILE_COUNT(PROFILE_STRINGIFY_CONTAINER);
+                bool is_array = v->type == JSON_ARRAY;
+                if(is_array ? (!v->array || v->array->data.empty()) : (!v->object || v->object->data.empty())){
+                    buf.put_string(is_array ? "[]" : "{}", 2);
+                    break;
+                }
+                size_t level = depth + stack.size();
+                bool exposed = (is_array ? v->array->exposed : v->object->exposed).load(std::memory_order_relaxed);
+                if(options.cache_fragments){
+                    // 节点上有键相同的片段时直接复制；带stamp的片段要核对通过
+                    const Fragment *f = (is_array ? v->array->fragment : v->object->fragment).load(std::memory_order_acquire);
+                    if(f && f->key == fragment_key(level) && fragment_current(*v, f)){
+                        buf.put_string(f->text.data(), f->text.length());
+                        if(!f->stamp.empty() && !stack.empty()){
+                            stack.back().cacheable = false;
+                        }
+                        break;
+                    }
+                }
+                Frame frame = {v, 0, {}, buf.top, !exposed};
+                if(!is_array){
+                    frame.iter = v->object->data.begin();
+                }
+                stack.push_back(frame);
+                buf.put_char(is_array ? '[' : '{');
+                put_newline(level + 1);
+                break;
+            }
+            default:
+                break;
+        }
+
+        /**********找到下一个要输出的值，逐层关闭已输出完的容器***************/
+        while(1){
+            if(stack.empty()){
+                return GENERATE_OK;
+            }
+            Frame &f = stack.back();
+            size_t level = depth + stack.size() - 1;
+            if(f.node->type == JSON_ARRAY){
+                if(f.count != f.node->array->data.size()){
+                    if(f.count != 0){
+                        put_comma(level + 1);
+                    }
+                    v = &f.node->array->data[f.count++];
+                    break;
+                }
+            }
+            else if(f.iter != f.node->object->data.end()){
+                if(f.count++ != 0){
+                    put_comma(level + 1);
+                }
+                int ret = stringify_string(f.iter->first);
+                if(ret != GENERATE_OK){
+                    return ret;
+                }
+                put_colon();
+                v = &f.iter->second;
+                ++f.iter;
+                break;
+            }
+            put_newline(level);
+            buf.put_char(f.node->type == JSON_ARRAY ? ']' : '}');
+            // 子树中有exposed的节点时，它的内容可能在片段安装后被修改，本节点及祖先的片段都带stamp
+            bool cacheable = f.cacheable;
+            if(options.cache_fragments){
+                install_fragment(*f.node, level, f.head, !cacheable);
+            }
+            stack.pop_back();
+            if(!cacheable && !stack.empty()){
+                stack.back().cacheable = false;
+            }
+        }
+    }
+}
+
+// 片段的键由生成选项决定，带缩进时还取决于层次
+uint64_t Generator::fragment_key(size_t depth)
+{
+    const FormatOptions &f = options.format;
+    uint64_t key = 0;
+    if(options.pretty){
+        char flags[4] = {(char)f.indent_char, (char)f.space_after_colon, (char)f.space_after_comma, 1};
+        key = hash_bytes(flags, sizeof(flags), 14695981039346656037ull);
+        key = hash_bytes(f.newline, strlen(f.newline), key);
+        key = hash_mix(key ^ f.indent);
+        if(f.indent != 0){
+            key = hash_mix(key + depth);
+        }
+    }
+    // 检查UTF-8或转义非ASCII字符时不能复用按其他方式输出的片段
+    if(options.invalid_utf8 != UTF8_KEEP || options.ensure_ascii){
+        key = hash_mix(key + options.invalid_utf8 + (options.ensure_ascii ? 4 : 0));
+    }
+    return key;
+}
+
+// 把buf中从head开始的输出缓存为节点的片段，stamped为true时同时记录直接子节点的状态。
+// 只在没有片段时安装，已有片段不会被替换，其他线程可能正在读取它；
+// 节点被修改时(此时只有一个持有者)片段才被删除。
+void Generator::install_fragment(const Value &v, size_t depth, size_t head, bool stamped)
+{
+    static std::atomic<uint64_t> serials(0);
+    std::atomic<Fragment *> &slot = v.type == JSON_ARRAY ? v.array->fragment : v.object->fragment;
+    if(slot.load(std::memory_order_acquire) != nullptr){
+        return;
+    }
+    std::vector<uint64_t> stamp;
+    if(stamped && !stamp_children(v, stamp, nullptr)){
+        return;
+    }
+    Fragment *f = new Fragment{fragment_key(depth), std::string(buf.stack + head, buf.top - head),
+                               serials.fetch_add(1, std::memory_order_relaxed) + 1, std::move(stamp)};
+    Fragment *expected = nullptr;
+    if(!slot.compare_exchange_strong(expected, f, std::memory_order_acq_rel)){
+        delete f;
+    }
+}
+
+// 每个直接子节点记两项：类型(容器还有其片段的serial)和内容。数字直接比较，
+// 字符串比较内容的哈希(释放后重新分配可能得到相同的地址)，容器比较地址和片段的serial：
+// 容器被修改时片段被删除，重新安装的片段serial不同。
+// 子容器的片段也带stamp时加入stamped，由调用者继续核对；非空的子容器没有片段时返回false
+bool Generator::stamp_children(const Value &v, std::vector<uint64_t> &stamp,
+                               std::vector<std::pair<const Value *, const Fragment *>> *stamped)
+{
+    const uint64_t basis = 14695981039346656037ull;
+    size_t n = v.type == JSON_ARRAY ? v.array->data.size() : v.object->data.size();
+    std::unordered_map<std::string, Value>::const_iterator iter;
+    if(v.type == JSON_OBJECT){
+        iter = v.object->data.begin();
+    }
+    for(size_t i = 0; i != n; ++i){
+        const Value &c = v.type == JSON_ARRAY ? v.array->data[i] : (iter++)->second;
+        uint64_t head = c.type;
+        uint64_t content = 0;
+        switch(c.type){
+            case JSON_NUMBER:
+                head |= (uint64_t)c.kind << 4;
+                content = c.kind == Value::NUMBER_RAW ? hash_bytes(c.str->data.data(), c.str->data.length(), basis) : c.u64;
+                break;
+            case JSON_STRING:
+            case JSON_RAW:
+                content = hash_bytes(c.str->data.data(), c.str->data.length(), basis);
+                break;
+            case JSON_ARRAY:
+            case JSON_OBJECT:{
+                // 空容器没有片段，之后添加元素时内容一项不再为0
+                if(c.type == JSON_ARRAY ? (!c.array || c.array->data.empty()) : (!c.object || c.object->data.empty())){
+                    break;
+                }
+                const Fragment *f = (c.type == JSON_ARRAY ? c.array->fragment : c.object->fragment).load(std::memory_order_acquire);
+                if(f == nullptr){
+                    return false;
+                }
+                head |= f->serial << 8;
+                content = (uint64_t)(uintptr_t)c.str;
+                if(stamped && !f->stamp.empty()){
+                    stamped->push_back(std::make_pair(&c, f));
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        stamp.push_back(head);
+        stamp.push_back(content);
+    }
+    return true;
+}
+
+// 片段安装之后子树是否可能被修改过：带stamp的片段逐层核对，不在C栈上递归
+bool Generator::fragment_current(const Value &v, const Fragment *f)
+{
+    if(f->stamp.empty()){
+        return true;
+    }
+    std::vector<std::pair<const Value *, const Fragment *>> pending(1, std::make_pair(&v, f));
+    std::vector<uint64_t> stamp;
+    while(!pending.empty()){
+        std::pair<const Value *, const Fragment *> p = pending.back();
+        pending.pop_back();
+        stamp.clear();
+        if(!stamp_children(*p.first, stamp, &pending) || stamp != p.second->stamp){
+            return false;
+        }
+    }
+    return true;
+}
+
+// 以下三个函数在紧凑模式下只输出必要的字符，Generator与Writer共用
+static void format_newline(Buffer &buf, const GenerateOptions &options, size_t depth)
+{
+    if(options.pretty && options.format.indent != 0){
+        size_t newline = strlen(options.format.newline);
+        if(newline != 0){
+            buf.put_string(options.format.newline, newline);
+        }
+        size_t len = depth * options.format.indent;
+        if(len != 0){
+            memset(buf.push(len), options.format.indent_char, len);
+        }
+    }
+}
+
+static void format_comma(Buffer &buf, const GenerateOptions &options, size_t depth)
+{
+    buf.put_char(',');
+    if(options.pretty){
+        if(options.format.indent != 0){
+            format_newline(buf, options, depth);
+        }
+        else if(options.format.space_after_comma){
+            buf.put_char(' ');
+        }
+    }
+}
+
+static void format_colon(Buffer &buf, const GenerateOptions &options)
+{
+    buf.put_char(':');
+    if(options.pretty && options.format.space_after_colon){
+        buf.put_char(' ');
+    }
+}
+
+void Generator::put_newline(size_t depth)
+{
+    format_newline(buf, options, depth);
+}
+
+void Generator::put_comma(size_t depth)
+{
+    format_comma(buf, options, depth);
+}
+
+void Generator::put_colon()
+{
+    format_colon(buf, options);
+}
+
+int Generator::stringify_string(const std::string &s)
+{
+    PROFILE_SCOPE(PROFILE_STRINGIFY_STRING, buf.top);
+    return put_escaped(buf, s.data(), s.length(), options.invalid_utf8, options.ensure_ascii);
+}
+
+
+/**********************************************************
+ *                                                        *
+ *                                                        *
+ *                      Emitter                           *
+ *                                                        *
+ *                                                        *
+ * ********************************************************/
+void Emitter::put_char(char ch)
+{
+    buf.put_char(ch);
+}
+
+void Emitter::put_raw(const char *s, size_t len)
+{
+    if(len != 0){
+        memcpy(buf.push(len), s, len);
+    }
+}
+
+void Emitter::put_string(const char *s, size_t len)
+{
+    put_escaped(buf, s, len);
+}
+
+void Emitter::put_number(double n)
+{
+    JsonCpp::put_number(buf, n);
+}
+
+void Emitter::put_int64(int64_t i)
+{
+    JsonCpp::put_int64(buf, i);
+}
+
+void Emitter::put_uint64(uint64_t u)
+{
+    JsonCpp::put_uint64(buf, u);
+}
+
+void Emitter::finish()
+{
+    json.append(buf.stack, buf.top);
+    buf.top = 0;
+}
+
+
+/**********************************************************
+ *                                                        *
+ *                                                        *
+ *                     StreamReader                       *
+ *                                                        *
+ *                                                        *
+ * ********************************************************/
+// 后台读线程与解析线程之间的双缓冲：读线程读入下一块时，解析线程处理窗口中的上一块
+struct StreamReader::Prefetch{
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable cv;
+    std::string block;                  // 已读入、尚未取走的一块
+    long result = 0;                    // block的字节数，0为流结束，-1为读取失败
+    bool full = false;
+    bool stop = false;
+};
+
+StreamReader::~StreamReader()
+{
+    if(prefetch != nullptr){
+        {
+            std::lock_guard<std::mutex> guard(prefetch->lock);
+            prefetch->stop = true;
+        }
+        prefetch->cv.notify_all();
+        prefetch->thread.join();
+        delete prefetch;
+    }
+}
+
+// 读入最多n字节，返回读到的字节数，流结束时为0，失败时为-1
+long StreamReader::read_block(char *dst, size_t n)
+{
+    if(is != nullptr){
+        is->read(dst, n);
+        return is->bad() ? -1 : (long)is->gcount();
+    }
+#ifndef _WIN32
+    ssize_t ret;
+    do{
+        ret = ::read(fd, dst, n);
+    }while(ret < 0 && errno == EINTR);
+    return ret;
+#else
+    return _read(fd, dst, (unsigned)n);
+#endif
+}
+
+// 移除已返回的文档后在窗口末尾追加一块，返回追加的字节数，失败时返回-1
+int StreamReader::fill()
+{
+    if(begin != 0){
+        window.erase(0, begin);
+        consumed += begin;
+        scan -= begin;
+        start -= started ? begin : 0;
+        begin = 0;
+    }
+    long n;
+    if(overlapped){
+        if(prefetch == nullptr){
+            prefetch = new Prefetch;
+            Prefetch *p = prefetch;
+            p->thread = std::thread([this, p]{
+                std::string next;
+                long ret;
+                do{
+                    next.resize(chunk);
+                    ret = read_block(&next[0], chunk);
+                    next.resize(ret > 0 ? ret : 0);
+                    std::unique_lock<std::mutex> guard(p->lock);
+                    p->cv.wait(guard, [p]{ return !p->full || p->stop; });
+                    if(p->stop){
+                        return;
+                    }
+                    p->block.swap(next);
+                    p->result = ret;
+                    p->full = true;
+                    p->cv.notify_all();
+                }while(ret > 0);
+            });
+        }
+        std::unique_lock<std::mutex> guard(prefetch->lock);
+        prefetch->cv.wait(guard, [this]{ return prefetch->full; });
+        n = prefetch->result;
+        if(n > 0){
+            window.append(prefetch->block);
+            prefetch->full = false;     // 流结束或失败后保持full，之后的调用得到相同的结果
+            prefetch->cv.notify_all();
+        }
+    }
+    else{
+        size_t old = window.size();
+        window.resize(old + chunk);
+        n = read_block(&window[old], chunk);
+        window.resize(old + (n > 0 ? n : 0));
+    }
+    if(n < 0){
+        return -1;
+    }
+    eof = n == 0;
+    return n;
+}
+
+// 只跟踪字符串和括号的嵌套，找到顶层文档结束的位置；语法由Parser检查。
+// 顶层的数字和字面量在遇到空白或下一个文档的开始时结束
+bool StreamReader::find_end(size_t &end)
+{
+    const char *p = window.data();
+    size_t len = window.size();
+    for(; scan != len; ++scan){
+        char ch = p[scan];
+        if(!started){
+            // 文档之前的空白随即丢弃，下次fill时从窗口中移除，连续的空行不会使窗口增长
+            if(ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r'){
+                begin = scan + 1;
+                continue;
+            }
+            started = true;
+            start = scan;
+            if(ch == '"'){
+                in_string = true;
+            }
+            else if(ch == '[' || ch == '{'){
+                depth = 1;
+            }
+            continue;
+        }
+        if(in_string){
+            if(escape){
+                escape = false;
+            }
+            else if(ch == '\\'){
+                escape = true;
+            }
+            else if(ch == '"'){
+                in_string = false;
+                if(depth == 0){
+                    end = ++scan;
+                    return true;
+                }
+            }
+        }
+        else if(depth == 0){
+            if(ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '"' || ch == '[' || ch == '{'){
+                end = scan;
+                return true;
+            }
+        }
+        else if(ch == '"'){
+            in_string = true;
+        }
+        else if(ch == '[' || ch == '{'){
+            ++depth;
+        }
+        else if(ch == ']' || ch == '}'){
+            if(--depth == 0){
+                end = ++scan;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// 丢弃窗口中end之前的内容并重置扫描状态
+void StreamReader::skip_document(size_t end)
+{
+    begin = scan = end;
+    started = in_string = escape = false;
+    depth = 0;
+}
+
+int StreamReader::next(Value &v)
+{
+    v.set_null();
+    // 上一个文档过大时不再缓存其余部分，从下一个换行处重新开始
+    while(resync){
+        size_t newline = window.find('\n', begin);
+        if(newline != std::string::npos){
+            skip_document(newline + 1);
+            resync = false;
+        }
+        else{
+            skip_document(window.size());
+            if(eof){
+                resync = false;
+            }
+            else if(fill() < 0){
+                return STREAM_IO_ERROR;
+            }
+        }
+    }
+
+    size_t end;
+    while(!find_end(end)){
+        if(started && window.size() - start > options.max_document_size){
+            skip_document(window.size());
+            resync = true;
+            return STREAM_DOCUMENT_TOO_LARGE;
+        }
+        if(eof){
+            if(!started){
+                consumed += window.size();
+                window.clear();
+                begin = scan = 0;
+                return STREAM_END;
+            }
+            end = window.size();        // 最后一个文档不完整时由Parser报告错误
+            break;
+        }
+        if(fill() < 0){
+            return STREAM_IO_ERROR;
+        }
+    }
+    if(end - start > options.max_document_size){
+        skip_document(end);
+        return STREAM_DOCUMENT_TOO_LARGE;
+    }
+
+    Parser parser(window);
+    parser.max_depth = options.max_depth;
+    parser.check_utf8 = options.validate_utf8;
+    parser.raw_numbers = options.raw_numbers;
+    parser.pos = start;
+    int ret = parser.parse_value(v);
+    if(ret == PARSE_OK && parser.pos != end){
+        ret = PARSE_ROOT_NOT_SINGULAR;
+    }
+    if(ret != PARSE_OK){
+        v.set_null();
+    }
+    // 无论成功与否都跳过这个文档
+    skip_document(end);
+    return ret;
+}
+
+/**********************************************************
+ *                                                        *
+ *                                                        *
+ *                       Writer                           *
+ *                                                        *
+ *                                                        *
+ * ********************************************************/
+// 写入ostream时缓冲超过这个大小就写出一次
+static const size_t WRITER_FLUSH_SIZE = 64 * 1024;
+
+// 逗号和换行在值之前输出：容器为空时只输出"[]"/"{}"，与Generator的格式一致
+void Writer::before_value()
+{
+    if(stack.empty()){
+        assert(!done && "Writer: only one top-level value");
+        done = true;
+        return;
+    }
+    if(stack.back().object){
+        assert(after_key && "Writer: a value in an object must follow key()");
+        after_key = false;
+        return;
+    }
+    before_element();
+}
+
+void Writer::before_element()
+{
+    if(stack.back().count++ == 0){
+        format_newline(buf, options, stack.size());
+    }
+    else{
+        format_comma(buf, options, stack.size());
+    }
+}
+
+void Writer::after_value()
+{
+    if(os != nullptr && buf.top >= WRITER_FLUSH_SIZE){
+        os->write(buf.stack, buf.top);
+        buf.top = 0;
+    }
+}
+
+void Writer::start(bool object)
+{
+    before_value();
+    buf.put_char(object ? '{' : '[');
+    stack.push_back(Level{object, 0});
+}
+
+void Writer::end(bool object)
+{
+    assert(!stack.empty() && stack.back().object == object && !after_key && "Writer: unbalanced end");
+    if(stack.empty()){
+        return;
+    }
+    if(stack.back().count != 0){
+        format_newline(buf, options, stack.size() - 1);
+    }
+    buf.put_char(object ? '}' : ']');
+    stack.pop_back();
+    after_value();
+}
+
+void Writer::start_object()
+{
+    start(true);
+}
+
+void Writer::end_object()
+{
+    end(true);
+}
+
+void Writer::start_array()
+{
+    start(false);
+}
+
+void Writer::end_array()
+{
+    end(false);
+}
+
+void Writer::key(const char *s, size_t len)
+{
+    assert(!stack.empty() && stack.back().object && !after_key && "Writer: key() outside an object");
+    if(stack.empty()){
+        return;
+    }
+    before_element();
+    int ret = put_escaped(buf, s, len, options.invalid_utf8, options.ensure_ascii);
+    if(ret != GENERATE_OK && error == GENERATE_OK){
+        error = ret;
+    }
+    format_colon(buf, options);
+    after_key = true;
+}
+
+void Writer::key(const char *s)
+{
+    key(s, strlen(s));
+}
+
+void Writer::key(const std::string &s)
+{
+    key(s.data(), s.length());
+}
+
+void Writer::string(const char *s, size_t len)
+{
+    before_value();
+    int ret = put_escaped(buf, s, len, options.invalid_utf8, options.ensure_ascii);
+    if(ret != GENERATE_OK && error == GENERATE_OK){
+        error = ret;
+    }
+    after_value();
+}
+
+void Writer::string(const char *s)
+{
+    string(s, strlen(s));
+}
+
+void Writer::string(const std::string &s)
+{
+    string(s.data(), s.length());
+}
+
+void Writer::number(double n)
+{
+    before_value();
+    put_number(buf, n);
+    after_value();
+}
+
+void Writer::int64(int64_t i)
+{
+    before_value();
+    put_int64(buf, i);
+    after_value();
+}
+
+void Writer::uint64(uint64_t u)
+{
+    before_value();
+    put_uint64(buf, u);
+    after_value();
+}
+
+void Writer::boolean(bool b)
+{
+    before_value();
+    if(b){
+        buf.put_string("true", 4);
+    }
+    else{
+        buf.put_string("false", 5);
+    }
+    after_value();
+}
+
+void Writer::null()
+{
+    before_value();
+    buf.put_string("null", 4);
+    after_value();
+}
+
+void Writer::raw(const char *s, size_t len)
+{
+    before_value();
+    if(len != 0){
+        buf.put_string(s, len);
+    }
+    after_value();
+}
+
+// 输出剩余内容并重置状态，之后可以写下一个文档
+int Writer::finish()
+{
+    assert(stack.empty() && done && "Writer: unfinished document");
+    if(os != nullptr){
+        os->write(buf.stack, buf.top);
+    }
+    else{
+        json->append(buf.stack, buf.top);
+    }
+    buf.top = 0;
+    stack.clear();
+    after_key = false;
+    done = false;
+    int ret = error;
+    error = GENERATE_OK;
+    return ret;
+}
+
+
+/**********************************************************
+ *                                                        *
+ *                                                        *
+ *                       Context                          *
+ *                                                        *
+ *                                                        *
+ * ********************************************************/
+
+// 把保留的缓冲区借给一次性的Parser/Generator，用完再取回
+int Context::parse(const std::string &json, Value &value)
+{
+    return parse(json, value, ParseOptions());
+}
+
+int Context::parse(const std::string &json, Value &value, const ParseOptions &options)
+{
+    Parser parser(json);
+    parser.max_depth = options.max_depth;
+    parser.check_utf8 = options.validate_utf8;
+    parser.raw_numbers = options.raw_numbers;
+    parser.buf.swap(parse_buf);
+    int ret = parser.run(value);
+    parser.buf.swap(parse_buf);
+    finish(parse_buf);
+    return ret;
+}
+
+int Context::generate(std::string &json, const Value &value)
+{
+    return generate(json, value, GenerateOptions());
+}
+
+int Context::generate(std::string &json, const Value &value, const GenerateOptions &options)
+{
+    Generator generator(json, options);
+    generator.buf.swap(generate_buf);
+    int ret = generator.run(value);
+    generator.buf.swap(generate_buf);
+    finish(generate_buf);
+    return ret;
+}
+
+void Context::finish(Buffer &buf)
+{
+    buf.top = 0;
+    if(buf.size > trim_threshold){
+        buf.clear();
+    }
+}
+
+void Context::trim()
+{
+    parse_buf.clear();
+    generate_buf.clear();
+}
+
+Context &Context::local()
+{
+    thread_local Context context;
+    return context;
+}
+
+
+/**********************************************************
+ *                                                        *
+ *                                                        *
+ *                    SharedDocument                      *
+ *                                                        *
+ *                                                        *
+ * ********************************************************/
+// 线程第一次读取时轮流分配一组计数器
+static unsigned reader_stripe()
+{
+    static std::atomic<unsigned> next_stripe(0);
+    thread_local unsigned stripe = next_stripe.fetch_add(1, std::memory_order_relaxed);
+    return stripe;
+}
+
+SharedDocument::SharedDocument(Value v) : current(new Value(std::move(v))), epoch(0), versions(0)
+{
+    for(auto & s : stripes){
+        s.readers[0].store(0);
+        s.readers[1].store(0);
+    }
+}
+
+SharedDocument::~SharedDocument()
+{
+    delete current.load();
+}
+
+// 读者先按epoch的奇偶增加计数，再读取当前文档。原子操作都是顺序一致的：
+// 计数没有被写者看到的读者，一定读到写者替换后的新文档
+SharedDocument::Guard SharedDocument::read() const
+{
+    std::atomic<long> *counter = &stripes[reader_stripe() % STRIPES].readers[epoch.load() & 1];
+    counter->fetch_add(1);
+    return Guard(counter, current.load());
+}
+
+Value SharedDocument::load() const
+{
+    Guard guard = read();
+    return *guard;
+}
+
+void SharedDocument::wait_readers(unsigned parity)
+{
+    for(auto & s : stripes){
+        while(s.readers[parity].load() != 0){
+            std::this_thread::yield();
+        }
+    }
+}
+
+// 替换后翻转两次epoch，每次等待刚被离开、不再有新读者进入的那一组计数归零：
+// 第一次等待替换前开始的读者；另一组中可能有在上一次翻转前读到epoch、稍后才计数的读者，
+// 它们读到的也可能是旧文档，由第二次等待
+void SharedDocument::store(Value v)
+{
+    Value *next = new Value(std::move(v));
+    Value *old;
+    {
+        std::lock_guard<std::mutex> guard(write_lock);
+        old = current.exchange(next);
+        versions.fetch_add(1);
+        for(int i = 0; i != 2; ++i){
+            wait_readers(epoch.fetch_add(1) & 1);
+        }
+    }
+    delete old;
+}
+
+int SharedDocument::reload(const std::string &json, const ParseOptions &options)
+{
+    Value v;
+    int ret = Json_Parse(json, v, options);
+    if(ret == PARSE_OK){
+        store(std::move(v));
+    }
+    return ret;
+}
+
+
+/**********************************************************
+ *                                                        *
+ *                                                        *
+ *                     MessagePack                        *
+ *                                                        *
+ *                                                        *
+ * ********************************************************/
+
+// 数字：能精确表示为64位整数的用最短的整数格式，其余用float64
+// 字符串：str8/16/32(解码时bin也当作字符串)；数组/对象：fixarray/fixmap或16/32位长度
+int MsgPackWriter::run(const Value &v)
+{
+    int ret = pack_value(v);
+    if(ret != GENERATE_OK){
+        return ret;
+    }
+    out.append(buf.stack, buf.top);
+    return GENERATE_OK;
+}
+
+void MsgPackWriter::put_be(unsigned char tag, unsigned long long u, size_t bytes)
+{
+    unsigned char *q = (unsigned char *)buf.push(bytes + 1);
+    *q++ = tag;
+    for (size_t i = bytes; i != 0; --i){
+        q[i - 1] = u & 0xFF;
+        u >>= 8;
+    }
+}
+
+void MsgPackWriter::pack_header(unsigned char fix, size_t fix_max, unsigned char tag16, size_t n)
+{
+    if(n <= fix_max){
+        buf.put_char(fix | n);
+    }
+    else if(n <= 0xFFFF){
+        put_be(tag16, n, 2);
+    }
+    else{
+        put_be(tag16 + 1, n, 4);
+    }
+}
+
+void MsgPackWriter::pack_number(double n)
+{
+    if(n == std::floor(n) && n >= -9223372036854775808.0 && n < 18446744073709551616.0
+       && !(n == 0 && std::signbit(n))){
+        if(n >= 0){
+            pack_uint64((uint64_t)n);
+        }
+        else{
+            pack_int64((int64_t)n);
+        }
+        return;
+    }
+    unsigned long long bits;
+    memcpy(&bits, &n, sizeof(bits));
+    put_be(0xCB, bits, 8);
+}
+
+void MsgPackWriter::pack_int64(int64_t i)
+{
+    if(i >= 0)                    pack_uint64(i);
+    else if(i >= -32)             buf.put_char(i & 0xFF);
+    else if(i >= -128)            put_be(0xD0, i, 1);
+    else if(i >= -32768)          put_be(0xD1, i, 2);
+    else if(i >= -2147483648LL)   put_be(0xD2, i, 4);
+    else                          put_be(0xD3, i, 8);
+}
+
+void MsgPackWriter::pack_uint64(uint64_t u)
+{
+    if(u < 0x80)              buf.put_char(u);
+    else if(u <= 0xFF)        put_be(0xCC, u, 1);
+    else if(u <= 0xFFFF)      put_be(0xCD, u, 2);
+    else if(u <= 0xFFFFFFFF)  put_be(0xCE, u, 4);
+    else                      put_be(0xCF, u, 8);
+}
+
+void MsgPackWriter::pack_string(const std::string &s)
+{
+    size_t len = s.length();
+    if(len < 32){
+        buf.put_char(0xA0 | len);
+    }
+    else if(len <= 0xFF){
+        put_be(0xD9, len, 1);
+    }
+    else{
+        pack_header(0xDA, 0, 0xDA, len);
+    }
+    if(len != 0){
+        memcpy(buf.push(len), s.data(), len);
+    }
+}
+
+// 数组和对象不在C栈上递归：正在输出的容器保存在显式的栈中，任意深的文档都不会栈溢出。
+// 字符串长度或元素个数超过格式的32位上限时返回GENERATE_SIZE_EXCEEDED
+int MsgPackWriter::pack_value(const Value &root)
+{
+    struct Frame{
+        const Value *node;
+        size_t index;                                                   // 数组中下一个元素
+        std::unordered_map<std::string, Value>::const_iterator iter;    // 对象中下一个键值对
+    };
+    std::vector<Frame> stack;
+    const Value *v = &root;
+    while(1){
+        switch(v->type)
+        {
+            case JSON_NULL:
+                buf.put_char(0xC0);
+                break;
+            case JSON_FALSE:
+                buf.put_char(0xC2);
+                break;
+            case JSON_TRUE:
+                buf.put_char(0xC3);
+                break;
+            case JSON_NUMBER:
+                if(v->kind == Value::NUMBER_RAW){
+                    pack_value(v->parse_raw_number());
+                }
+                else if(v->kind == Value::NUMBER_INT64){
+                    pack_int64(v->i64);
+                }
+                else if(v->kind == Value::NUMBER_UINT64){
+                    pack_uint64(v->u64);
+                }
+                else{
+                    pack_number(v->num);
+                }
+                break;
+            case JSON_STRING:
+                if(v->str->data.length() > 0xFFFFFFFF){
+                    return GENERATE_SIZE_EXCEEDED;
+                }
+                pack_string(v->str->data);
+                break;
+            case JSON_RAW:{
+                // 未经校验存入的片段不合法时返回解析的错误码，而不是写成null
+                Value tmp;
+                int ret = Json_Parse(v->str->data, tmp);
+                if(ret != PARSE_OK){
+                    return ret;
+                }
+                ret = pack_value(tmp);
+                if(ret != GENERATE_OK){
+                    return ret;
+                }
+                break;
+            }
+            case JSON_ARRAY:
+            case JSON_OBJECT:{
+                bool is_array = v->type == JSON_ARRAY;
+                size_t n = v->str == nullptr ? 0 : is_array ? v->array->data.size() : v->object->data.size();
+                if(n > 0xFFFFFFFF){
+                    return GENERATE_SIZE_EXCEEDED;
+                }
+                if(is_array){
+                    pack_header(0x90, 15, 0xDC, n);
+                }
+                else{
+                    pack_header(0x80, 15, 0xDE, n);
+                }
+                if(n != 0){
+                    Frame frame = {v, 0, {}};
+                    if(!is_array){
+                        frame.iter = v->object->data.begin();
+                    }
+                    stack.push_back(frame);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+
+        /**********找到下一个要输出的值，逐层关闭已输出完的容器***************/
+        while(1){
+            if(stack.empty()){
+                return GENERATE_OK;
+            }
+            Frame &f = stack.back();
+            if(f.node->type == JSON_ARRAY){
+                if(f.index != f.node->array->data.size()){
+                    v = &f.node->array->data[f.index++];
+                    break;
+                }
+            }
+            else if(f.iter != f.node->object->data.end()){
+                if(f.iter->first.length() > 0xFFFFFFFF){
+                    return GENERATE_SIZE_EXCEEDED;
+                }
+                pack_string(f.iter->first);
+                v = &f.iter->second;
+                ++f.iter;
+                break;
+            }
+            stack.pop_back();
+        }
+    }
+}
+
+// 读取bytes字节的大端整数，数据不足时返回false
+static bool load_be(const unsigned char *&p, const unsigned char *end, size_t bytes, unsigned long long &u)
+{
+    if((size_t)(end - p) < bytes){
+        return false;
+    }
+    u = 0;
+    for (size_t i = 0; i != bytes; ++i){
+        u = (u << 8) | *p++;
+    }
+    return true;
+}
+
+// 解码tag对应的数字，p指向tag之后；tag不是数字时返回PARSE_INVALID_VALUE
+static int msgpack_number(unsigned char tag, const unsigned char *&p, const unsigned char *end, double &d)
+{
+    unsigned long long u;
+    if(tag <= 0x7F || tag >= 0xE0){
+        d = (signed char)tag;
+        return PARSE_OK;
+    }
+    switch(tag)
+    {
+        case 0xCA:
+            if(!load_be(p, end, 4, u)) return PARSE_UNEXPECTED_END;
+            {
+                unsigned bits = (unsigned)u;
+                float f;
+                memcpy(&f, &bits, sizeof(f));
+                d = f;
+            }
+            return PARSE_OK;
+        case 0xCB:
+            if(!load_be(p, end, 8, u)) return PARSE_UNEXPECTED_END;
+            memcpy(&d, &u, sizeof(d));
+            return PARSE_OK;
+        case 0xCC: case 0xCD: case 0xCE: case 0xCF:
+            if(!load_be(p, end, (size_t)1 << (tag - 0xCC), u)) return PARSE_UNEXPECTED_END;
+            d = (double)u;
+            return PARSE_OK;
+        case 0xD0:
+            if(!load_be(p, end, 1, u)) return PARSE_UNEXPECTED_END;
+            d = (signed char)u;
+            return PARSE_OK;
+        case 0xD1:
+            if(!load_be(p, end, 2, u)) return PARSE_UNEXPECTED_END;
+            d = (short)u;
+            return PARSE_OK;
+        case 0xD2:
+            if(!load_be(p, end, 4, u)) return PARSE_UNEXPECTED_END;
+            d = (int)u;
+            return PARSE_OK;
+        case 0xD3:
+            if(!load_be(p, end, 8, u)) return PARSE_UNEXPECTED_END;
+            d = (double)(long long)u;
+            return PARSE_OK;
+        default:
+            return PARSE_INVALID_VALUE;
+    }
+}
+
+// tag为整数时解码为int64/uint64存入v并返回true，ret为结果；其他tag返回false且不移动p
+static bool msgpack_integer(unsigned char tag, const unsigned char *&p, const unsigned char *end, Value &v, int &ret)
+{
+    unsigned long long u;
+    ret = PARSE_OK;
+    if(tag <= 0x7F || tag >= 0xE0){
+        v.set_int64((signed char)tag);
+    }
+    else if(tag >= 0xCC && tag <= 0xCF){
+        if(!load_be(p, end, (size_t)1 << (tag - 0xCC), u)){
+            ret = PARSE_UNEXPECTED_END;
+        }
+        else{
+            v.set_uint64(u);
+        }
+    }
+    else if(tag >= 0xD0 && tag <= 0xD3){
+        if(!load_be(p, end, (size_t)1 << (tag - 0xD0), u)){
+            ret = PARSE_UNEXPECTED_END;
+        }
+        else{
+            switch(tag){
+                case 0xD0: v.set_int64((signed char)u); break;
+                case 0xD1: v.set_int64((short)u);       break;
+                case 0xD2: v.set_int64((int)u);         break;
+                default:   v.set_int64((long long)u);   break;
+            }
+        }
+    }
+    else{
+        return false;
+    }
+    return true;
+}
+
+// 解码字符串/数组/对象的长度，type返回对应的value_type；tag不是这几类时type为-1
+static int msgpack_length(unsigned char tag, const unsigned char *&p, const unsigned char *end, int &type, size_t &n)
+{
+    unsigned long long u = 0;
+    size_t bytes = 0;
+    type = -1;
+    if((tag & 0xE0) == 0xA0){
+        type = JSON_STRING;
+        n = tag & 0x1F;
+        return PARSE_OK;
+    }
+    if((tag & 0xF0) == 0x90 || (tag & 0xF0) == 0x80){
+        type = (tag & 0xF0) == 0x90 ? JSON_ARRAY : JSON_OBJECT;
+        n = tag & 0x0F;
+        return PARSE_OK;
+    }
+    switch(tag)
+    {
+        case 0xC4: case 0xD9: type = JSON_STRING; bytes = 1; break;
+        case 0xC5: case 0xDA: type = JSON_STRING; bytes = 2; break;
+        case 0xC6: case 0xDB: type = JSON_STRING; bytes = 4; break;
+        case 0xDC: type = JSON_ARRAY;  bytes = 2; break;
+        case 0xDD: type = JSON_ARRAY;  bytes = 4; break;
+        case 0xDE: type = JSON_OBJECT; bytes = 2; break;
+        case 0xDF: type = JSON_OBJECT; bytes = 4; break;
+        default:
+            return PARSE_INVALID_VALUE;
+    }
+    if(!load_be(p, end, bytes, u)){
+        return PARSE_UNEXPECTED_END;
+    }
+    n = u;
+    // 每个元素至少占1字节，字符串必须完整，以此拒绝伪造的超大长度
+    size_t need = type == JSON_OBJECT ? 2 * n : n;
+    if(need < n || (size_t)(end - p) < need){
+        return PARSE_UNEXPECTED_END;
+    }
+    return PARSE_OK;
+}
+
+int MsgPackReader::run(Value &v)
+{
+    int ret = unpack_value(v);
+    if(ret == PARSE_OK && p != end){
+        ret = PARSE_ROOT_NOT_SINGULAR;
+    }
+    if(ret != PARSE_OK){
+        v.set_null();
+    }
+    return ret;
+}
+
+int MsgPackReader::unpack_value(Value &v)
+{
+    if(p == end){
+        return PARSE_UNEXPECTED_END;
+    }
+    unsigned char tag = *p++;
+    switch(tag)
+    {
+        case 0xC0:
+            v.set_null();
+            return PARSE_OK;
+        case 0xC2:
+            v.set_false();
+            return PARSE_OK;
+        case 0xC3:
+            v.set_true();
+            return PARSE_OK;
+        default:
+            break;
+    }
+
+    int ret;
+    int type;
+    size_t n;
+    double d;
+    if((ret = msgpack_length(tag, p, end, type, n)) != PARSE_OK){
+        if(type != -1){
+            return ret;
+        }
+        if(msgpack_integer(tag, p, end, v, ret)){
+            return ret;
+        }
+        if((ret = msgpack_number(tag, p, end, d)) != PARSE_OK){
+            return ret;
+        }
+        v.set_number(d);
+        return PARSE_OK;
+    }
+
+    if(type == JSON_STRING){
+        if((size_t)(end - p) < n){
+            return PARSE_UNEXPECTED_END;
+        }
+        v.free();
+        v.type = JSON_STRING;
+        v.str = new SharedString(std::string((const char *)p, n));
+        p += n;
+        return PARSE_OK;
+    }
+
+    // 每个元素至少占一个字节，先检查个数再分配；出错时整个解码中止，不必恢复depth
+    if((size_t)(end - p) < n){
+        return PARSE_UNEXPECTED_END;
+    }
+    if(depth == max_depth){
+        return PARSE_DEPTH_EXCEEDED;
+    }
+    depth++;
+    if(type == JSON_ARRAY){
+        std::vector<Value> tmp(n);
+        for (size_t i = 0; i != n; ++i){
+            if((ret = unpack_value(tmp[i])) != PARSE_OK){
+                return ret;
+            }
+        }
+        depth--;
+        v.free();
+        v.type = JSON_ARRAY;
+        v.array = n ? new SharedArray(std::move(tmp)) : nullptr;
+        return PARSE_OK;
+    }
+
+    std::unordered_map<std::string, Value> tmp_object;
+    tmp_object.reserve(n);
+    for (size_t i = 0; i != n; ++i){
+        if(p == end){
+            return PARSE_UNEXPECTED_END;
+        }
+        tag = *p++;
+        size_t len;
+        if((ret = msgpack_length(tag, p, end, type, len)) != PARSE_OK || type != JSON_STRING){
+            return ret == PARSE_UNEXPECTED_END ? ret : PARSE_MISS_KEY;
+        }
+        if((size_t)(end - p) < len){
+            return PARSE_UNEXPECTED_END;
+        }
+        Value &e = tmp_object[std::string((const char *)p, len)];
+        p += len;
+        if((ret = unpack_value(e)) != PARSE_OK){
+            return ret;
+        }
+    }
+    depth--;
+    v.free();
+    v.type = JSON_OBJECT;
+    v.object = n ? new SharedObject(std::move(tmp_object)) : nullptr;
+    return PARSE_OK;
+}
+
+// 跳过p处的一个完整的值，数据非法时返回nullptr；用计数代替递归
+const unsigned char *MsgPackView::skip(const unsigned char *p, const unsigned char *end)
+{
+    size_t pending = 1;
+    while(pending != 0){
+        if(p == nullptr || p >= end){
+            return nullptr;
+        }
+        unsigned char tag = *p++;
+        pending--;
+        if(tag == 0xC0 || tag == 0xC2 || tag == 0xC3){
+            continue;
+        }
+        int type;
+        size_t n;
+        double d;
+        if(msgpack_length(tag, p, end, type, n) == PARSE_OK){
+            if(type == JSON_STRING){
+                if((size_t)(end - p) < n){
+                    return nullptr;
+                }
+                p += n;
+            }
+            else{
+                pending += type == JSON_OBJECT ? 2 * n : n;
+            }
+        }
+        else if(type != -1 || msgpack_number(tag, p, end, d) != PARSE_OK){
+            return nullptr;
+        }
+    }
+    return p;
+}
+
+// 返回数组/对象第一个元素的位置，n为元素(键值对)个数
+const unsigned char *MsgPackView::items(size_t &n) const
+{
+    if(p == nullptr || p >= end){
+        return nullptr;
+    }
+    const unsigned char *q = p + 1;
+    int type;
+    if(msgpack_length(*p, q, end, type, n) != PARSE_OK || (type != JSON_ARRAY && type != JSON_OBJECT)){
+        return nullptr;
+    }
+    return q;
+}
+
+int MsgPackView::get_type() const
+{
+    if(p == nullptr || p >= end){
+        return -1;
+    }
+    switch(*p)
+    {
+        case 0xC0: return JSON_NULL;
+        case 0xC2: return JSON_FALSE;
+        case 0xC3: return JSON_TRUE;
+        default: break;
+    }
+    const unsigned char *q = p + 1;
+    int type;
+    size_t n;
+    double d;
+    if(msgpack_length(*p, q, end, type, n) == PARSE_OK){
+        return type;
+    }
+    if(type == -1 && msgpack_number(*p, q, end, d) == PARSE_OK){
+        return JSON_NUMBER;
+    }
+    return -1;
+}
+
+double MsgPackView::get_number() const
+{
+    assert(get_type() == JSON_NUMBER);
+    const unsigned char *q = p + 1;
+    double d = 0;
+    msgpack_number(*p, q, end, d);
+    return d;
+}
+
+bool MsgPackView::get_string(const char *&s, size_t &len) const
+{
+    if(p == nullptr || p >= end){
+        return false;
+    }
+    const unsigned char *q = p + 1;
+    int type;
+    if(msgpack_length(*p, q, end, type, len) != PARSE_OK || type != JSON_STRING || (size_t)(end - q) < len){
+        return false;
+    }
+    s = (const char *)q;
+    return true;
+}
+
+size_t MsgPackView::size() const
+{
+    size_t n = 0;
+    return items(n) ? n : 0;
+}
+
+MsgPackView MsgPackView::operator[](size_t index) const
+{
+    size_t n;
+    const unsigned char *q = items(n);
+    if(q == nullptr || get_type() != JSON_ARRAY || index >= n){
+        return MsgPackView();
+    }
+    for (size_t i = 0; i != index && q; ++i){
+        q = skip(q, end);
+    }
+    return q ? MsgPackView(q, end) : MsgPackView();
+}
+
+MsgPackView MsgPackView::operator[](const std::string &key) const
+{
+    size_t n;
+    const unsigned char *q = items(n);
+    if(q == nullptr || get_type() != JSON_OBJECT){
+        return MsgPackView();
+    }
+    for (size_t i = 0; i != n && q; ++i){
+        MsgPackView k(q, end);
+        const char *s;
+        size_t len;
+        if(!k.get_string(s, len)){
+            return MsgPackView();
+        }
+        q = skip(q, end);
+        if(len == key.length() && memcmp(s, key.data(), len) == 0){
+            return q ? MsgPackView(q, end) : MsgPackView();
+        }
+        q = skip(q, end);
+    }
+    return MsgPackView();
+}
+
+
+/**********************************************************
+ *                                                        *
+ *                                                        *
+ *                      Snapshot                          *
+ *                                                        *
+ *                                                        *
+ * ********************************************************/
+
+// 文件格式(本机字节序，所有偏移相对文件开头，节点和表按8字节对齐)：
+//   0  "JCSN"          4  版本         8  字节序标记    12 保留
+//   16 文件大小         24 校验和(覆盖32字节之后的全部内容)
+//   32 根节点
+// 节点16字节：type(1) 保留(3) count(4) payload(8)
+//   数字   保留的第1字节为存储方式(0 double，1 int64，2 uint64)，payload为对应的位模式
+//   字符串 count为长度，payload为字节的偏移(其后有NUL)
+//   数组   count为元素个数，payload为count个子节点的偏移
+//   对象   count为键值对个数，payload为按键排序的键表(每项：键偏移8 键长4 保留4)，
+//          键表之后紧跟count个值节点
+static const unsigned SNAPSHOT_VERSION = 2;            // 版本1的数字只有double，仍可读取
+static const unsigned SNAPSHOT_ENDIAN = 0x01020304;
+static const size_t SNAPSHOT_HEADER = 32;
+static const size_t SNAPSHOT_NODE = 16;
+
+static unsigned long long snapshot_checksum(const char *p, size_t n)
+{
+    unsigned long long h = 0x9E3779B97F4A7C15ULL ^ n;
+    unsigned long long w;
+    for(; n >= 8; p += 8, n -= 8){
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0x100000001B3ULL;
+        h ^= h >> 29;
+    }
+    for(; n != 0; ++p, --n){
+        h = (h ^ (unsigned char)*p) * 0x100000001B3ULL;
+    }
+    return h;
+}
+
+static inline unsigned load_u32(const char *p)
+{
+    unsigned u;
+    memcpy(&u, p, sizeof(u));
+    return u;
+}
+
+static inline unsigned long long load_u64(const char *p)
+{
+    unsigned long long u;
+    memcpy(&u, p, sizeof(u));
+    return u;
+}
+
+int SnapshotWriter::run(const Value &v)
+{
+    out.clear();
+    reserve(SNAPSHOT_HEADER + SNAPSHOT_NODE);
+    int ret = write_node(SNAPSHOT_HEADER, v);
+    if(ret != GENERATE_OK){
+        out.clear();
+        return ret;
+    }
+
+    unsigned long long size = out.length();
+    memcpy(&out[0], "JCSN", 4);
+    memcpy(&out[4], &SNAPSHOT_VERSION, 4);
+    memcpy(&out[8], &SNAPSHOT_ENDIAN, 4);
+    memcpy(&out[16], &size, 8);
+    unsigned long long sum = snapshot_checksum(out.data() + SNAPSHOT_HEADER, size - SNAPSHOT_HEADER);
+    memcpy(&out[24], &sum, 8);
+    return GENERATE_OK;
+}
+
+// 在末尾按8字节对齐分配n字节(填0)，返回其偏移
+size_t SnapshotWriter::reserve(size_t n)
+{
+    size_t at = (out.length() + 7) & ~(size_t)7;
+    out.resize(at + n, '\0');
+    return at;
+}
+
+size_t SnapshotWriter::append(const std::string &s)
+{
+    size_t at = out.length();
+    out.append(s);
+    out += '\0';
+    return at;
+}
+
+// 不在C栈上递归：待写的节点(槽位的偏移和值)保存在显式的栈中，子节点逆序入栈，
+// 写出的顺序与深度优先的递归相同，任意深的文档都不会栈溢出。
+// 节点中长度和个数只有32位，超出时返回GENERATE_SIZE_EXCEEDED而不是截断
+int SnapshotWriter::write_node(size_t at, const Value &root)
+{
+    typedef std::pair<const std::string, Value> Entry;
+    struct Task{
+        size_t at;                  // 节点的槽位
+        const Value *value;
+        const Entry *entry;         // 对象的成员：写值之前先写键
+        size_t key_slot;            // 键表中对应的项
+    };
+    std::vector<Task> tasks;
+    tasks.push_back(Task{at, &root, nullptr, 0});
+    while(!tasks.empty()){
+        Task task = tasks.back();
+        tasks.pop_back();
+        const Value &v = *task.value;
+        if(task.entry != nullptr){
+            if(task.entry->first.length() > 0xFFFFFFFF){
+                return GENERATE_SIZE_EXCEEDED;
+            }
+            unsigned long long key = append(task.entry->first);
+            unsigned len = task.entry->first.length();
+            memcpy(&out[task.key_slot], &key, 8);
+            memcpy(&out[task.key_slot + 8], &len, 4);
+        }
+
+        char node[SNAPSHOT_NODE] = {0};
+        unsigned count = 0;
+        unsigned long long payload = 0;
+        node[0] = (char)v.type;
+        switch(v.type)
+        {
+            case JSON_RAW:{
+                // 解析出的值中没有JSON_RAW，这里最多递归一层；片段不合法时返回解析的错误码
+                Value tmp;
+                int ret = Json_Parse(v.str->data, tmp);
+                if(ret != PARSE_OK){
+                    return ret;
+                }
+                ret = write_node(task.at, tmp);
+                if(ret != GENERATE_OK){
+                    return ret;
+                }
+                continue;
+            }
+            case JSON_NUMBER:
+                if(v.kind == Value::NUMBER_RAW){
+                    write_node(task.at, v.parse_raw_number());
+                    continue;
+                }
+                node[1] = (char)v.kind;
+                payload = v.u64;
+                break;
+            case JSON_STRING:
+                if(v.str->data.length() > 0xFFFFFFFF){
+                    return GENERATE_SIZE_EXCEEDED;
+                }
+                count = v.str->data.length();
+                payload = append(v.str->data);
+                break;
+            case JSON_ARRAY:
+                if(v.array && v.array->data.size() > 0xFFFFFFFF){
+                    return GENERATE_SIZE_EXCEEDED;
+                }
+                count = v.array ? v.array->data.size() : 0;
+                payload = reserve(count * SNAPSHOT_NODE);
+                for (size_t i = count; i != 0; --i){
+                    tasks.push_back(Task{payload + (i - 1) * SNAPSHOT_NODE, &v.array->data[i - 1], nullptr, 0});
+                }
+                break;
+            case JSON_OBJECT:
+            {
+                std::vector<const Entry *> entries;
+                if(v.object){
+                    for(auto & p : v.object->data){
+                        entries.push_back(&p);
+                    }
+                }
+                if(entries.size() > 0xFFFFFFFF){
+                    return GENERATE_SIZE_EXCEEDED;
+                }
+                std::sort(entries.begin(), entries.end(),
+                          [](const Entry *a, const Entry *b) { return a->first < b->first; });
+                count = entries.size();
+                payload = reserve(count * SNAPSHOT_NODE * 2);
+                size_t values = payload + count * SNAPSHOT_NODE;
+                for (size_t i = count; i != 0; --i){
+                    const Entry *p = entries[i - 1];
+                    tasks.push_back(Task{values + (i - 1) * SNAPSHOT_NODE, &p->second, p, payload + (i - 1) * SNAPSHOT_NODE});
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        memcpy(node + 4, &count, 4);
+        memcpy(node + 8, &payload, 8);
+        memcpy(&out[task.at], node, SNAPSHOT_NODE);
+    }
+    return GENERATE_OK;
+}
+
+// 以下访问函数都做越界检查，快照损坏时返回类型为-1的空视图而不会越界读
+bool SnapshotValue::read_node(unsigned &type, unsigned &count, unsigned long long &payload) const
+{
+    if(base == nullptr || node > length || length - node < SNAPSHOT_NODE){
+        return false;
+    }
+    type = (unsigned char)base[node];
+    count = load_u32(base + node + 4);
+    payload = load_u64(base + node + 8);
+    if(type == JSON_STRING){
+        return payload < length && length - payload > count;
+    }
+    if(type == JSON_ARRAY || type == JSON_OBJECT){
+        unsigned long long table = (unsigned long long)count * SNAPSHOT_NODE * (type == JSON_OBJECT ? 2 : 1);
+        return payload <= length && length - payload >= table;
+    }
+    return type <= JSON_NUMBER;
+}
+
+SnapshotValue SnapshotValue::child(unsigned long long offset) const
+{
+    return SnapshotValue(base, length, offset);
+}
+
+int SnapshotValue::get_type() const
+{
+    unsigned type, count;
+    unsigned long long payload;
+    return read_node(type, count, payload) ? (int)type : -1;
+}
+
+// 数字的三个访问函数在类型不符或越界时返回0
+double SnapshotValue::get_number() const
+{
+    unsigned type, count;
+    unsigned long long payload;
+    if(!read_node(type, count, payload) || type != JSON_NUMBER){
+        return 0;
+    }
+    switch(base[node + 1]){
+        case 1:  return (double)(int64_t)payload;
+        case 2:  return (double)payload;
+    }
+    double d;
+    memcpy(&d, &payload, sizeof(d));
+    return d;
+}
+
+int64_t SnapshotValue::get_int64() const
+{
+    unsigned type, count;
+    unsigned long long payload;
+    if(!read_node(type, count, payload) || type != JSON_NUMBER){
+        return 0;
+    }
+    return base[node + 1] == 0 ? (int64_t)get_number() : (int64_t)payload;
+}
+
+uint64_t SnapshotValue::get_uint64() const
+{
+    unsigned type, count;
+    unsigned long long payload;
+    if(!read_node(type, count, payload) || type != JSON_NUMBER){
+        return 0;
+    }
+    return base[node + 1] == 0 ? (uint64_t)get_number() : payload;
+}
+
+bool SnapshotValue::get_string(const char *&s, size_t &len) const
+{
+    unsigned type, count;
+    unsigned long long payload;
+    if(!read_node(type, count, payload) || type != JSON_STRING){
+        return false;
+    }
+    s = base + payload;
+    len = count;
+    return true;
+}
+
+size_t SnapshotValue::size() const
+{
+    unsigned type, count;
+    unsigned long long payload;
+    if(!read_node(type, count, payload) || (type != JSON_ARRAY && type != JSON_OBJECT)){
+        return 0;
+    }
+    return count;
+}
+
+SnapshotValue SnapshotValue::operator[](size_t index) const
+{
+    unsigned type, count;
+    unsigned long long payload;
+    if(!read_node(type, count, payload) || type != JSON_ARRAY || index >= count){
+        return SnapshotValue();
+    }
+    return child(payload + index * SNAPSHOT_NODE);
+}
+
+// 键表有序，二分查找
+SnapshotValue SnapshotValue::operator[](const std::string &key) const
+{
+    unsigned type, count;
+    unsigned long long payload;
+    if(!read_node(type, count, payload) || type != JSON_OBJECT){
+        return SnapshotValue();
+    }
+    size_t lo = 0;
+    size_t hi = count;
+    while(lo < hi){
+        size_t mid = lo + (hi - lo) / 2;
+        const char *entry = base + payload + mid * SNAPSHOT_NODE;
+        unsigned long long off = load_u64(entry);
+        size_t len = load_u32(entry + 8);
+        if(off >= length || length - off <= len){
+            return SnapshotValue();
+        }
+        int cmp = memcmp(base + off, key.data(), std::min(len, key.length()));
+        if(cmp == 0){
+            cmp = len < key.length() ? -1 : (len > key.length() ? 1 : 0);
+        }
+        if(cmp == 0){
+            return child(payload + (count + mid) * SNAPSHOT_NODE);
+        }
+        if(cmp < 0){
+            lo = mid + 1;
+        }
+        else{
+            hi = mid;
+        }
+    }
+    return SnapshotValue();
+}
+
+int Snapshot::check(bool verify) const
 {
-    if(u <= 0x007F){
-        buf.put_char(u & 0xFF);
+    if(length < SNAPSHOT_HEADER + SNAPSHOT_NODE || memcmp(data, "JCSN", 4) != 0){
+        return SNAPSHOT_CORRUPTED;
     }
-    else if(u <= 0x7FF){
-        buf.put_char(0xC0 | (u >> 6) & 0xFF);
-        buf.put_char(0x80 | u & 0x3F);
+    unsigned version = load_u32(data + 4);
+    if((version != SNAPSHOT_VERSION && version != 1) || load_u32(data + 8) != SNAPSHOT_ENDIAN){
+        return SNAPSHOT_VERSION_MISMATCH;
     }
-    else if(u <= 0xFFFF){
-        buf.put_char(0xE0 | ((u >> 12) & 0xFF));
-        buf.put_char(0x80 | ((u >> 6) & 0x3F));
-        buf.put_char(0x80 | u & 0x3F);
+    if(load_u64(data + 16) != length){
+        return SNAPSHOT_CORRUPTED;
     }
-    else{
-        assert(u <= 0x10FFFF);
-        buf.put_char(0xF0 | (u >> 18) & 0xFF);
-        buf.put_char(0x80 | (u >> 12) & 0x3F);
-        buf.put_char(0x80 | (u >> 6) & 0x3F);
-        buf.put_char(0x80 | u & 0x3F);
+    if(verify && load_u64(data + 24) != snapshot_checksum(data + SNAPSHOT_HEADER, length - SNAPSHOT_HEADER)){
+        return SNAPSHOT_CORRUPTED;
     }
+    return PARSE_OK;
 }
 
-bool Parser::parse_hex4(unsigned &u)
+// 直接使用调用者的内存，不拷贝，调用者需保证其生命周期
+int Snapshot::load(const char *buffer, size_t len, bool verify)
 {
-    u = 0;
-    for (int i = 0; i != 4; ++i){
-        char ch = json[pos++];
-        u <<= 4;
-        if(ch >= '0' && ch <= '9'){
-            u |= (ch - '0');
-        }
-        else if(ch >= 'A' && ch <= 'F'){
-            u |= (ch - 'A' + 10);
-        }
-        else if(ch >= 'a' && ch <= 'f'){
-            u |= (ch - 'a' + 10);
-        }
-        else{
-            return false;
-        }
+    close();
+    data = buffer;
+    length = len;
+    int ret = check(verify);
+    if(ret != PARSE_OK){
+        close();
     }
-    return true;
+    return ret;
 }
 
-/**********************************************************
- *                                                        *
- *                                                        *
- *                     Generator                          *
- *                                                        *
- *                                                        *
- * ********************************************************/
-int Generator::run(const Value &v)
+int Snapshot::open(const std::string &path, bool verify)
 {
-    int ret = stringify_value(v);
-    if(ret != GENERATE_OK)
-    {
-        buf.clear();
-        return ret;
+    close();
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        return SNAPSHOT_IO_ERROR;
     }
-    json.append(buf.stack, buf.top);
-    return GENERATE_OK;
+    struct stat st;
+    if(fstat(fd, &st) != 0){
+        ::close(fd);
+        return SNAPSHOT_IO_ERROR;
+    }
+    if(st.st_size == 0){
+        ::close(fd);
+        return SNAPSHOT_CORRUPTED;
+    }
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(p == MAP_FAILED){
+        return SNAPSHOT_IO_ERROR;
+    }
+    data = (const char *)p;
+    length = st.st_size;
+    mapped = true;
+#else
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if(!in){
+        return SNAPSHOT_IO_ERROR;
+    }
+    storage.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    data = storage.data();
+    length = storage.length();
+#endif
+    int ret = check(verify);
+    if(ret != PARSE_OK){
+        close();
+    }
+    return ret;
 }
 
+// 快照不存在、版本不一致或已损坏时，改为解析json_path并重建快照
+int Snapshot::open_or_build(const std::string &path, const std::string &json_path, bool verify)
+{
+    if(open(path, verify) == PARSE_OK){
+        return PARSE_OK;
+    }
+    std::ifstream in(json_path.c_str(), std::ios::binary);
+    if(!in){
+        return SNAPSHOT_IO_ERROR;
+    }
+    std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    Value v;
+    int ret = Json_Parse(json, v);
+    if(ret != PARSE_OK){
+        return ret;
+    }
+    if(Json_Write_Snapshot(path, v) == GENERATE_OK && open(path, false) == PARSE_OK){
+        return PARSE_OK;
+    }
+    // 无法写入快照文件时直接使用内存中的快照
+    ret = Json_Snapshot(storage, v);
+    if(ret != GENERATE_OK){
+        return ret;
+    }
+    data = storage.data();
+    length = storage.length();
+    return PARSE_OK;
+}
 
-int Generator::stringify_value(const Value &v)
+void Snapshot::close()
 {
-    char *tmp_buffer;
-    size_t tmp_length;
-    switch(v.type)
-    {
-        case JSON_NULL:
-            buf.put_string("null", 4);
-            break;
-        case JSON_FALSE:
-            buf.put_string("false", 5);
-            break;
-        case JSON_TRUE:
-            buf.put_string("true", 4);
-            break;
-        case JSON_NUMBER:
-            tmp_buffer = (char*)buf.push(32);
-            tmp_length = sprintf(tmp_buffer, "%.17g", *(v.num));
-            buf.top -= 32 - tmp_length;
-            break;
-        case JSON_STRING:
-            stringify_string(v);
-            break;
-        case JSON_ARRAY:
-            buf.put_char('[');
-            if(v.array){
-                for (int i = 0; i != v.array->size(); ++i){
-                    stringify_value((*(v.array))[i]);
-                    if(i != v.array->size() - 1){
-                        buf.put_char(',');
-                    }
-                }
-            }
-            buf.put_char(']');
-            break;
-        case JSON_OBJECT:
-            buf.put_char('{');
-            if(v.object){
-                size_t cnt = 0;
-                for(auto & p : *(v.object)){
-                    stringify_string(p.first);
-                    buf.put_char(':');
-                    stringify_value(p.second);
-                    if(cnt != v.object->size() - 1){
-                        buf.put_char(',');
-                    }
-                    ++cnt;
-                }
-            }
-            buf.put_char('}');
-            break;
-        default:
-            break;
+#ifndef _WIN32
+    if(mapped){
+        munmap((void *)data, length);
     }
-    return GENERATE_OK;
+#endif
+    mapped = false;
+    data = nullptr;
+    length = 0;
+    storage.clear();
 }
 
-void Generator::stringify_string(const Value &v)
+SnapshotValue Snapshot::root() const
 {
-    const char hex_digits[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9'};
-    char *head;
-    char *p;
-    size_t len = v.str->length();
-    size_t size = len * 6 + 2;
-    p = head = (char*)buf.push(size);
-    *p++ = '"';
-    for (size_t i = 0; i != len; ++i)
-    {
-        unsigned char ch = (unsigned char)(*(v.str))[i];
-        switch(ch){
-            case '\"': *p++ = '\\'; *p++ = '\"'; break;
-            case '\\': *p++ = '\\'; *p++ = '\\'; break;
-            case '\b': *p++ = '\\'; *p++ = 'b';  break;
-            case '\f': *p++ = '\\'; *p++ = 'f';  break;
-            case '\n': *p++ = '\\'; *p++ = 'n';  break;
-            case '\r': *p++ = '\\'; *p++ = 'r';  break;
-            case '\t': *p++ = '\\'; *p++ = 't';  break;
-            default:
-                if(ch < 0x20){
-                    *p++ = '\\'; 
-                    *p++ = 'u';
-                    *p++ = '0';
-                    *p++ = '0';
-                    *p++ = hex_digits[ch >> 4];
-                    *p++ = hex_digits[ch & 15];
-                }  
-                else{
-                    *p++ = (*(v.str))[i];
-                }            
-        }
+    if(data == nullptr){
+        return SnapshotValue();
     }
-    *p++ = '"';
-    buf.top -= size - (p - head);
+    return SnapshotValue(data, length, SNAPSHOT_HEADER);
 }
 
 
@@ -568,6 +3809,7 @@ void* Buffer::push(size_t s)
     void *ret;
     assert(s > 0);
     if(top + s >= size){
+        PROFILE_SCOPE(PROFILE_BUFFER_GROW, size);
         if(size == 0){
             size = 256;
         }
@@ -606,6 +3848,158 @@ void Buffer::clear()
     top = 0;
 }
 
+void Buffer::swap(Buffer &b)
+{
+    std::swap(stack, b.stack);
+    std::swap(size, b.size);
+    std::swap(top, b.top);
+}
+
+
+
+/**********************************************************
+ *                                                        *
+ *                                                        *
+ *                     Projection                         *
+ *                                                        *
+ *                                                        *
+ * ********************************************************/
+
+// 添加一条JSON Pointer路径，返回其结果下标；路径格式错误返回-1
+// ""表示整个文档，"/a/0"表示键a对应值的第0个元素，"~1"和"~0"分别转义'/'和'~'
+int Projection::add(const std::string &pointer)
+{
+    if(!pointer.empty() && pointer[0] != '/'){
+        return -1;
+    }
+    int node = 0;
+    size_t i = 0;
+    while(i != pointer.length()){
+        std::string token;
+        for (++i; i != pointer.length() && pointer[i] != '/'; ++i){
+            if(pointer[i] == '~'){
+                if(i + 1 == pointer.length() || (pointer[i + 1] != '0' && pointer[i + 1] != '1')){
+                    return -1;
+                }
+                token += pointer[++i] == '0' ? '~' : '/';
+            }
+            else{
+                token += pointer[i];
+            }
+        }
+
+        int child = find_child(node, token.data(), token.length());
+        if(child < 0){
+            long index = -1;
+            if(!token.empty() && token.length() < 10 && (token == "0" || token[0] != '0')
+               && token.find_first_not_of("0123456789") == std::string::npos){
+                index = strtol(token.c_str(), nullptr, 10);
+            }
+            child = nodes.size();
+            nodes[node].children.push_back(std::make_pair(token, child));
+            nodes[node].indexes.push_back(index);
+            nodes.push_back(Node());
+        }
+        node = child;
+    }
+    if(nodes[node].slot < 0){
+        nodes[node].slot = slots++;
+    }
+    return nodes[node].slot;
+}
+
+int Projection::find_child(int node, const char *key, size_t len) const
+{
+    const Node &n = nodes[node];
+    for(size_t i = 0; i != n.children.size(); ++i){
+        const std::string &token = n.children[i].first;
+        if(token.length() == len && memcmp(token.data(), key, len) == 0){
+            return n.children[i].second;
+        }
+    }
+    return -1;
+}
+
+int Projection::find_child(int node, size_t index) const
+{
+    const Node &n = nodes[node];
+    for(size_t i = 0; i != n.indexes.size(); ++i){
+        if(n.indexes[i] >= 0 && (size_t)n.indexes[i] == index){
+            return n.children[i].second;
+        }
+    }
+    return -1;
+}
+
+
+/**********************************************************
+ *                                                        *
+ *                                                        *
+ *                        KeySet                          *
+ *                                                        *
+ *                                                        *
+ * ********************************************************/
+
+KeySet::KeySet(std::initializer_list<const char *> keys)
+{
+    for(const char *k : keys){
+        this->keys.push_back(k);
+    }
+    build();
+}
+
+KeySet::KeySet(const std::vector<std::string> &keys) : keys(keys)
+{
+    build();
+}
+
+// 带种子的FNV-1a
+uint32_t KeySet::hash(const char *s, size_t len, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ seed;
+    for(size_t i = 0; i != len; ++i){
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+// 槽数从键数的两倍起，每个大小尝试一批种子，都有冲突时槽数翻倍
+void KeySet::build()
+{
+    size_t size = 1;
+    while(size < keys.size() * 2){
+        size <<= 1;
+    }
+    for(;; size <<= 1){
+        mask = (uint32_t)(size - 1);
+        for(seed = 1; seed <= 64; ++seed){
+            table.assign(size, -1);
+            bool ok = true;
+            for(size_t i = 0; i != keys.size() && ok; ++i){
+                int &slot = table[hash(keys[i].data(), keys[i].length(), seed) & mask];
+                if(slot == -1){
+                    slot = (int)i;
+                }
+                else if(keys[slot] != keys[i]){
+                    ok = false;
+                }
+            }
+            if(ok){
+                return;
+            }
+        }
+    }
+}
+
+int KeySet::lookup(const char *s, size_t len) const
+{
+    int id = table[hash(s, len, seed) & mask];
+    if(id < 0){
+        return -1;
+    }
+    const std::string &k = keys[id];
+    return k.length() == len && memcmp(k.data(), s, len) == 0 ? id : -1;
+}
 
 
 /**********************************************************
@@ -616,35 +4010,38 @@ void Buffer::clear()
  *                                                        *
  * ********************************************************/
 
-Value::Value(const Value &v)
+// 与v共享数据，调用前this不持有任何数据
+void Value::share(const Value &v)
 {
     type = v.type;
     switch(type){
         case JSON_NUMBER:
-            num = new double(*(v.num));
+            kind = v.kind;
+            u64 = v.u64;
+            if(kind == NUMBER_RAW){
+                str->refs.fetch_add(1, std::memory_order_relaxed);
+            }
             break;
         case JSON_STRING:
-            str = new std::string(*(v.str));
-            break;
+        case JSON_RAW:
         case JSON_ARRAY:
-            if(v.array){
-                array = new std::vector<Value>(*(v.array));
-            }
-            else{
-                array = nullptr;
-            }
-            break;
         case JSON_OBJECT:
-            if(v.object){
-                object = new std::unordered_map<std::string, Value>(*(v.object));
-            }
-            else{
-                object = nullptr;
+            str = v.str;
+            if(str){
+                str->refs.fetch_add(1, std::memory_order_relaxed);
             }
             break;
+        default:
+            str = nullptr;
+            break;
     }
 }
 
+Value::Value(const Value &v)
+{
+    share(v);
+}
+
 Value::Value(Value &&v) noexcept
 {
     /*调试*/
@@ -655,76 +4052,159 @@ Value::Value(Value &&v) noexcept
 
 
     type = v.type;
-    switch (type)
-    {
-        case JSON_NULL:break;
-        case JSON_FALSE:break;
-        case JSON_TRUE:break;
+    kind = v.kind;
+    str = v.str;
+    v.type = JSON_NULL;
+    v.str = nullptr;
+}
+
+Value::Value(const double num) : type(JSON_NULL), str(nullptr)
+{
+    set_number(num);
+}
+
+Value::Value(const std::string& str) : type(JSON_NULL), str(nullptr)
+{
+    set_string(str);
+}
+
+// 释放一个引用，最后一个引用释放时删除数据
+template<typename T>
+static void release(Shared<T> *p)
+{
+    if(p && p->refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+        delete p;
+    }
+}
+
+// 释放持有的数据，之后为null
+void Value::free()
+{
+    switch(type){
         case JSON_NUMBER:
-            num = v.num;
-            v.num = nullptr;
+            if(kind == NUMBER_RAW){
+                release(str);
+            }
             break;
         case JSON_STRING:
-            str = v.str;
-            v.str = nullptr;
+        case JSON_RAW:
+            release(str);
             break;
         case JSON_ARRAY:
-            array = v.array;
-            v.array = nullptr;
+        case JSON_OBJECT:{
+            // 不递归地释放整棵树：子容器先被移入pending，再逐个释放
+            std::vector<Value> pending;
+            release_container(pending);
+            while(!pending.empty()){
+                Value v = std::move(pending.back());
+                pending.pop_back();
+                v.release_container(pending);
+            }
             break;
-        case JSON_OBJECT:
-            object = v.object;
-            v.object = nullptr;
+        }
+        default:
             break;
     }
+    type = JSON_NULL;
+    str = nullptr;
+}
+
+// 释放数组/对象的一个引用。释放的是最后一个引用时，把仍有数据的子容器
+// 移入pending后再删除容器本身，此时删除只涉及标量，不会递归
+void Value::release_container(std::vector<Value> &pending)
+{
+    if(str == nullptr){
+        return;
+    }
+    if(type == JSON_ARRAY){
+        if(array->refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+            for(auto & e : array->data){
+                if((e.type == JSON_ARRAY || e.type == JSON_OBJECT) && e.str != nullptr){
+                    pending.push_back(std::move(e));
+                }
+            }
+            delete array;
+        }
+    }
+    else{
+        if(object->refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+            for(auto & p : object->data){
+                if((p.second.type == JSON_ARRAY || p.second.type == JSON_OBJECT) && p.second.str != nullptr){
+                    pending.push_back(std::move(p.second));
+                }
+            }
+            delete object;
+        }
+    }
+    type = JSON_NULL;
+    str = nullptr;
+}
+
+// 调用者可能通过返回的引用修改内容，缓存的哈希和输出片段随之失效；
+// 此时数据只有一个持有者，可以直接删除片段。
+// 引用交给调用者之后，修改不一定再经过这里，节点被标记为exposed，不再缓存
+template<typename T>
+static void invalidate(Shared<T> *p, bool expose)
+{
+    if(expose){
+        p->exposed.store(true, std::memory_order_relaxed);
+    }
+    p->hash.store(0, std::memory_order_relaxed);
+    delete p->fragment.exchange(nullptr, std::memory_order_acq_rel);
+}
+
+std::vector<Value> &Value::mutable_array(bool expose)
+{
+    assert(type == JSON_ARRAY);
+    if(array == nullptr){
+        array = new SharedArray(std::vector<Value>());
+    }
+    else if(array->refs.load(std::memory_order_acquire) != 1){
+        SharedArray *copy = new SharedArray(array->data);
+        release(array);
+        array = copy;
+    }
+    invalidate(array, expose);
+    return array->data;
+}
+
+std::unordered_map<std::string, Value> &Value::mutable_object(bool expose)
+{
+    assert(type == JSON_OBJECT);
+    if(object == nullptr){
+        object = new SharedObject(std::unordered_map<std::string, Value>());
+    }
+    else if(object->refs.load(std::memory_order_acquire) != 1){
+        SharedObject *copy = new SharedObject(object->data);
+        release(object);
+        object = copy;
+    }
+    invalidate(object, expose);
+    return object->data;
 }
 
-Value::Value(const double num)
+bool Value::is_shared() const
 {
-    set_number(num);
+    if(type == JSON_STRING || type == JSON_RAW || type == JSON_ARRAY || type == JSON_OBJECT){
+        return str != nullptr && str->refs.load(std::memory_order_acquire) != 1;
+    }
+    return false;
 }
 
-Value::Value(const std::string& str)
+void Value::set_null()
 {
-    set_string(str);
+    free();
+    type = JSON_NULL;
 }
-
-
-
-void Value::free()
+void Value::set_array()
 {
-        switch(type){
-            case JSON_NULL:
-                break;
-            case JSON_FALSE:
-                break;
-            case JSON_TRUE:
-                break;
-            case JSON_NUMBER:
-                delete num;
-                num = nullptr;
-                break;
-            case JSON_STRING:
-                delete str;
-                str = nullptr;
-                break;
-            case JSON_ARRAY:
-                delete array;
-                array = nullptr;
-                break;
-            case JSON_OBJECT:
-                delete object;
-                object = nullptr;
-                break;
-            default:
-                break;
-        }
+    free();
+    type = JSON_ARRAY;
 }
-
-void Value::set_null()
+void Value::set_object()
 {
     free();
-    type = JSON_NULL;
+    type = JSON_OBJECT;
 }
 void Value::set_true()
 {
@@ -740,14 +4220,35 @@ void Value::set_number(double n)
 {
     free();
     type = JSON_NUMBER;
-    num = new double(n);
+    kind = NUMBER_DOUBLE;
+    num = n;
+}
+
+void Value::set_int64(int64_t n)
+{
+    free();
+    type = JSON_NUMBER;
+    kind = NUMBER_INT64;
+    i64 = n;
+}
+
+void Value::set_uint64(uint64_t n)
+{
+    if(n <= (uint64_t)INT64_MAX){
+        set_int64((int64_t)n);
+        return;
+    }
+    free();
+    type = JSON_NUMBER;
+    kind = NUMBER_UINT64;
+    u64 = n;
 }
 
 void Value::set_string(const std::string &s)
 {
     free();
     type = JSON_STRING;
-    str = new std::string(s);
+    str = new SharedString(s);
 }
 
 int Value::get_type() const
@@ -758,31 +4259,129 @@ int Value::get_type() const
 double Value::get_number() const
 {
     assert(type == JSON_NUMBER);
-    return *num;
+    switch(kind){
+        case NUMBER_INT64:  return (double)i64;
+        case NUMBER_UINT64: return (double)u64;
+        case NUMBER_RAW:    return parse_raw_number().get_number();
+        default:            return num;
+    }
+}
+
+bool Value::is_int64() const
+{
+    if(type == JSON_NUMBER && kind == NUMBER_RAW){
+        return parse_raw_number().is_int64();
+    }
+    return type == JSON_NUMBER && kind == NUMBER_INT64;
+}
+
+bool Value::is_uint64() const
+{
+    if(type == JSON_NUMBER && kind == NUMBER_RAW){
+        return parse_raw_number().is_uint64();
+    }
+    return type == JSON_NUMBER && (kind == NUMBER_UINT64 || (kind == NUMBER_INT64 && i64 >= 0));
+}
+
+int64_t Value::get_int64() const
+{
+    assert(type == JSON_NUMBER);
+    if(kind == NUMBER_RAW){
+        return parse_raw_number().get_int64();
+    }
+    return kind == NUMBER_DOUBLE ? (int64_t)num : i64;
+}
+
+uint64_t Value::get_uint64() const
+{
+    assert(type == JSON_NUMBER);
+    if(kind == NUMBER_RAW){
+        return parse_raw_number().get_uint64();
+    }
+    return kind == NUMBER_DOUBLE ? (uint64_t)num : u64;
+}
+
+bool Value::is_raw_number() const
+{
+    return type == JSON_NUMBER && kind == NUMBER_RAW;
+}
+
+const std::string &Value::get_raw_number() const
+{
+    assert(is_raw_number());
+    return str->data;
+}
+
+int Value::set_raw_json(const std::string &json, bool validate)
+{
+    if(validate){
+        int ret = Json_Validate(json);
+        if(ret != PARSE_OK){
+            return ret;
+        }
+    }
+    free();
+    type = JSON_RAW;
+    str = new SharedString(json);
+    return PARSE_OK;
+}
+
+const std::string &Value::get_raw_json() const
+{
+    assert(type == JSON_RAW);
+    return str->data;
+}
+
+// s为已通过语法检查的数字
+void Value::set_raw_number(const char *s, size_t len)
+{
+    free();
+    type = JSON_NUMBER;
+    kind = NUMBER_RAW;
+    str = new SharedString(std::string(s, len));
+}
+
+// 把原始文本转换为double或整数，超出double范围时为±HUGE_VAL
+// 文本已通过语法检查，直接转换而不再完整地解析；超出double范围时为inf
+Value Value::parse_raw_number() const
+{
+    Value v;
+    const char *s = str->data.c_str();
+    if(!integer_value(s, s + str->data.length(), v)){
+        v.set_number(strtod(s, nullptr));
+    }
+    return v;
 }
 
 std::string Value::get_string() const
 {
     assert(type == JSON_STRING);
-    return *str;
+    return str->data;
 }
 
 int Value::get_array_size() const
 {
     assert(type == JSON_ARRAY);
     if(array){
-        return array->size();
+        return array->data.size();
     }
     else{
         return 0;
     }
 }
 
-Value* Value::get_array_element(size_t index) const
+const Value* Value::get_array_element(size_t index) const
+{
+    assert(type == JSON_ARRAY);
+    assert(index < (size_t)get_array_size());
+    return &array->data[index];
+}
+
+Value* Value::get_array_element(size_t index)
 {
     assert(type == JSON_ARRAY);
-    assert(index < array->size());
-    return &(*array)[index];
+    assert(index < (size_t)get_array_size());
+    return &mutable_array(true)[index];
 }
 
 int Value::get_object_size() const
@@ -792,107 +4391,149 @@ int Value::get_object_size() const
         return 0;
     }
     else{
-        return object->size();
+        return object->data.size();
     }
 }
 
 void Value::erase_array_element(size_t index, size_t count)
 {
     assert(type == JSON_ARRAY);
-    assert(index + count <= array->size());
-    array->erase(array->begin() + index, array->begin() + index + count);
+    assert(index + count <= (size_t)get_array_size());
+    if(count == 0){
+        return;
+    }
+    std::vector<Value> &a = mutable_array();
+    a.erase(a.begin() + index, a.begin() + index + count);
 }
 
 void Value::clear_array()
 {
     assert(type == JSON_ARRAY);
     if(array){
-        array->clear();
+        release(array);
+        array = nullptr;
     }
 }
 
-void Value::insert_array_element(Value &v, size_t index)
+void Value::insert_array_element(const Value &v, size_t index)
+{
+    assert(type == JSON_ARRAY);
+    assert(index <= (size_t)get_array_size());
+    std::vector<Value> &a = mutable_array();
+    a.insert(a.begin() + index, v);
+}
+
+void Value::insert_array_element(Value &&v, size_t index)
 {
     assert(type == JSON_ARRAY);
-    assert(index < array->size());
-    array->insert(array->begin() + index, v);
+    assert(index <= (size_t)get_array_size());
+    std::vector<Value> &a = mutable_array();
+    a.insert(a.begin() + index, std::move(v));
 }
 
-std::vector<Value> Value::get_array()
+void Value::push_back(const Value &v)
 {
     assert(type == JSON_ARRAY);
-    return *array;
+    mutable_array().push_back(v);
 }
 
-std::unordered_map<std::string, Value> Value::get_object()
+void Value::push_back(Value &&v)
+{
+    assert(type == JSON_ARRAY);
+    mutable_array().push_back(std::move(v));
+}
+
+void Value::reserve(size_t n)
+{
+    assert(type == JSON_ARRAY || type == JSON_OBJECT);
+    if(type == JSON_ARRAY){
+        mutable_array().reserve(n);
+    }
+    else{
+        mutable_object().reserve(n);
+    }
+}
+
+std::vector<Value> Value::get_array() const
+{
+    assert(type == JSON_ARRAY);
+    return array ? array->data : std::vector<Value>();
+}
+
+std::unordered_map<std::string, Value> Value::get_object() const
 {
     assert(type == JSON_OBJECT);
-    return *object;
+    return object ? object->data : std::unordered_map<std::string, Value>();
 }
 
-Value* Value::get_object_value(const std::string &key) const
+const Value* Value::get_object_value(const std::string &key) const
 {
     assert(type == JSON_OBJECT);
-    for(auto & p : *object){
-        if(p.first == key){
-            return &(p.second);
-        }
+    if(object == nullptr){
+        return nullptr;
     }
-    return nullptr;
+    auto iter = object->data.find(key);
+    return iter != object->data.end() ? &iter->second : nullptr;
 }
 
-void Value::set_object_value(const std::string &key, Value &v)
+Value* Value::get_object_value(const std::string &key)
 {
     assert(type == JSON_OBJECT);
-    Value *tmp = get_object_value(key);
-    if(tmp){
-        *tmp = v;
-    }
-    else{
-        (*(object))[key] = v;
+    if(!find_object_value(key)){
+        return nullptr;
     }
+    return &mutable_object(true)[key];
+}
+
+void Value::set_object_value(const std::string &key, const Value &v)
+{
+    assert(type == JSON_OBJECT);
+    mutable_object()[key] = v;
+}
+
+void Value::set_object_value(const std::string &key, Value &&v)
+{
+    assert(type == JSON_OBJECT);
+    mutable_object()[key] = std::move(v);
+}
+
+Value &Value::insert_or_assign(const std::string &key, const Value &v)
+{
+    assert(type == JSON_OBJECT);
+    Value &slot = mutable_object(true)[key];
+    slot = v;
+    return slot;
+}
+
+// 键只在插入时移入，值在查找之后才移动，键已存在时也不会丢失
+Value &Value::insert_or_assign(std::string &&key, Value &&v)
+{
+    assert(type == JSON_OBJECT);
+    Value &slot = mutable_object(true)[std::move(key)];
+    slot = std::move(v);
+    return slot;
 }
 
 void Value::remove_object_value(const std::string &key)
 {
     assert(type == JSON_OBJECT);
-    auto iter = object->find(key);
-    object->erase(iter);
+    if(find_object_value(key)){
+        mutable_object().erase(key);
+    }
 }
 
 bool Value::find_object_value(const std::string &key) const
 {
     assert(type == JSON_OBJECT);
-    for(auto & p : *(object)){
-        if(p.first == key){
-            return true;
-        }
-    }
-    return false;
+    return object != nullptr && object->data.count(key) != 0;
 }
 
 
 Value& Value::operator=(const Value &rhs)
 {   
-    free();
-    type = rhs.type;
-    switch(type){
-        case JSON_NUMBER:
-            num = new double(*(rhs.num));
-            break;
-        case JSON_STRING:
-            str = new std::string(*(rhs.str));
-            break;
-        case JSON_ARRAY:
-            if(rhs.array){
-                array = new std::vector<Value>(*(rhs.array));
-            }
-            break;
-        case JSON_OBJECT:
-            if(rhs.object){
-                object = new std::unordered_map<std::string, Value>(*(rhs.object));
-            }
-            break;
+    if(this != &rhs){
+        Value tmp(rhs);     // rhs可能是this的子节点，先持有它再释放自身
+        *this = std::move(tmp);
     }
     return *this;
 }
@@ -905,42 +4546,31 @@ Value& Value::operator=(Value &&rhs) noexcept
     /* */
 
     if(this != &rhs){
+        // rhs可能是this的子节点，先取走再释放自身
+        value_type t = rhs.type;
+        number_kind k = rhs.kind;
+        SharedString *p = rhs.str;
+        rhs.type = JSON_NULL;
+        rhs.str = nullptr;
         free();
-        type = rhs.type;
-        switch (type)
-        {
-            case JSON_NULL:break;
-            case JSON_FALSE:break;
-            case JSON_TRUE:break;
-            case JSON_NUMBER:
-                num = rhs.num;
-                rhs.num = nullptr;
-                break;
-            case JSON_STRING:
-                str = rhs.str;
-                rhs.str = nullptr;
-                break;
-            case JSON_ARRAY:
-                array = rhs.array;
-                rhs.array = nullptr;
-                break;
-            case JSON_OBJECT:
-                object = rhs.object;
-                rhs.object = nullptr;
-                break;
-        }
+        type = t;
+        kind = k;
+        str = p;
     }
+    return *this;
 }
 
 
 Value& Value::operator=(const std::string &str)
 {
     set_string(str);
+    return *this;
 }
 
 Value& Value::operator=(const double num)
 {
     set_number(num);
+    return *this;
 }
 
 
@@ -948,30 +4578,279 @@ Value& Value::operator=(const double num)
 Value& Value::operator[](size_t index)
 {
     assert(type == JSON_ARRAY);
-    assert(index < array->size());
-    return (*(array))[index];
+    assert(index < (size_t)get_array_size());
+    return mutable_array(true)[index];
 }
 
 Value& Value::operator[](const std::string &str)
 {
     assert(type == JSON_OBJECT);
     assert(find_object_value(str) == true);
-    return (*(object))[str];
+    return mutable_object(true)[str];
 }
 
-bool operator==(const Value &lhs, const Value &rhs)
+const Value& Value::operator[](size_t index) const
+{
+    return *get_array_element(index);
+}
+
+const Value& Value::operator[](const std::string &str) const
+{
+    assert(find_object_value(str) == true);
+    return *get_object_value(str);
+}
+
+// 整数v与d是否相等：d必须恰好是这个整数
+static bool number_equals(const Value &v, double d)
 {
-    if(lhs.type != rhs.type){
+    if(d != std::floor(d)){
         return false;
     }
-    if(lhs.type == JSON_STRING){
-        return *(lhs.str) == *(rhs.str);
+    if(v.is_int64()){
+        return d >= -9223372036854775808.0 && d < 9223372036854775808.0 && (int64_t)d == v.get_int64();
+    }
+    return d >= 0 && d < 18446744073709551616.0 && (uint64_t)d == v.get_uint64();
+}
+
+// 数组按顺序组合元素的哈希；对象把每个键值对的哈希相加，与键的顺序无关。
+// 容器不在C栈上递归：正在计算的容器保存在显式的栈中，任意深的文档都不会栈溢出。
+// 子树中有exposed的节点时(见Shared::exposed)，本节点及祖先的结果不缓存
+uint64_t Value::hash() const
+{
+    const uint64_t basis = 14695981039346656037ull;
+    uint64_t h;
+    switch(type){
+        case JSON_NUMBER:{
+            if(kind == NUMBER_RAW){
+                return parse_raw_number().hash();
+            }
+            // 整数能精确表示为double时与相等的double哈希相同
+            double d = get_number();
+            if(kind != NUMBER_DOUBLE && !number_equals(*this, d)){
+                return hash_mix(u64 ^ (JSON_NUMBER + kind * 16));
+            }
+            d = d == 0 ? 0.0 : d;                   // 0与-0相等
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            return hash_mix(bits ^ JSON_NUMBER);
+        }
+        case JSON_STRING:
+            return hash_mix(hash_bytes(str->data.data(), str->data.length(), basis) ^ JSON_STRING);
+        case JSON_RAW:{
+            // 与解析后的值哈希相同，结果缓存在片段上
+            if((h = str->hash.load(std::memory_order_relaxed)) != 0){
+                return h;
+            }
+            Value tmp;
+            Json_Parse(str->data, tmp);
+            h = tmp.hash();
+            h = h ? h : 1;
+            str->hash.store(h, std::memory_order_relaxed);
+            return h;
+        }
+        case JSON_ARRAY:
+        case JSON_OBJECT:
+            break;
+        default:
+            return hash_mix(type + 1);
     }
-    else if(lhs.type == JSON_ARRAY){
-        return *(lhs.array) == *(rhs.array);
+
+    struct Frame{
+        const Value *node;
+        size_t index;                                                   // 数组中下一个元素
+        std::unordered_map<std::string, Value>::const_iterator iter;    // 对象中下一个键值对
+        uint64_t h;                                                     // 已合并的哈希
+        uint64_t key;                                                   // 正在计算的值对应的键的哈希
+        bool cacheable;
+    };
+    std::vector<Frame> stack;
+    const Value *v = this;
+    bool cacheable;
+    while(1){
+        /**********标量和已缓存的容器直接得到结果，否则压栈***************/
+        bool pushed = false;
+        if(v->type != JSON_ARRAY && v->type != JSON_OBJECT){
+            h = v->hash();
+            cacheable = true;
+        }
+        else if(v->str == nullptr){
+            h = hash_mix(v->type);                  // 空数组/空对象
+            cacheable = true;
+        }
+        else{
+            bool is_array = v->type == JSON_ARRAY;
+            bool exposed = (is_array ? v->array->exposed : v->object->exposed).load(std::memory_order_relaxed);
+            h = exposed ? 0 : (is_array ? v->array->hash : v->object->hash).load(std::memory_order_relaxed);
+            cacheable = true;
+            if(h == 0){
+                Frame frame = {v, 0, {}, is_array ? hash_mix(JSON_ARRAY) : 0, 0, !exposed};
+                if(!is_array){
+                    frame.iter = v->object->data.begin();
+                }
+                stack.push_back(frame);
+                pushed = true;
+            }
+        }
+
+        /**********合并到父节点，找到下一个要计算的值，逐层完成已计算完的容器***************/
+        while(1){
+            if(!pushed){
+                if(stack.empty()){
+                    return h;
+                }
+                Frame &f = stack.back();
+                if(f.node->type == JSON_ARRAY){
+                    f.h = hash_mix(f.h ^ h);
+                }
+                else{
+                    f.h += hash_mix(f.key ^ hash_mix(h));
+                }
+                f.cacheable = f.cacheable && cacheable;
+            }
+            pushed = false;
+            Frame &f = stack.back();
+            if(f.node->type == JSON_ARRAY){
+                if(f.index != f.node->array->data.size()){
+                    v = &f.node->array->data[f.index++];
+                    break;
+                }
+                h = f.h;
+            }
+            else{
+                if(f.iter != f.node->object->data.end()){
+                    f.key = hash_bytes(f.iter->first.data(), f.iter->first.length(), basis);
+                    v = &f.iter->second;
+                    ++f.iter;
+                    break;
+                }
+                h = hash_mix(f.h ^ ((uint64_t)f.node->object->data.size() << 8) ^ JSON_OBJECT);
+            }
+            h = h ? h : 1;
+            cacheable = f.cacheable;
+            if(cacheable){
+                (f.node->type == JSON_ARRAY ? f.node->array->hash : f.node->object->hash).store(h, std::memory_order_relaxed);
+            }
+            stack.pop_back();
+        }
     }
-    else if(lhs.type == JSON_OBJECT){
-        return *(lhs.object) == *(rhs.object);
+}
+
+// 已缓存的哈希不同时直接判定不等，不会为比较而计算哈希
+static bool hash_differs(const std::atomic<uint64_t> &a, const std::atomic<uint64_t> &b)
+{
+    uint64_t ha = a.load(std::memory_order_relaxed);
+    uint64_t hb = b.load(std::memory_order_relaxed);
+    return ha != 0 && hb != 0 && ha != hb;
+}
+
+// 容器不在C栈上递归：正在比较的一对容器保存在显式的栈中，任意深的文档都不会栈溢出
+bool operator==(const Value &lhs, const Value &rhs)
+{
+    struct Frame{
+        const Value *lhs;
+        const Value *rhs;
+        size_t index;                                                   // 数组中下一个元素
+        std::unordered_map<std::string, Value>::const_iterator iter;    // lhs中下一个键值对
+    };
+    std::vector<Frame> stack;
+    const Value *l = &lhs;
+    const Value *r = &rhs;
+    while(1){
+        /**********比较两个值本身，需要逐个比较元素的容器压栈***************/
+        if(l->type == JSON_RAW || r->type == JSON_RAW){
+            // JSON片段与解析后的值比较，解析出的值中没有JSON_RAW，这里最多递归一层
+            Value pl, pr;
+            if(l->type == JSON_RAW){
+                Json_Parse(l->str->data, pl);
+            }
+            if(r->type == JSON_RAW){
+                Json_Parse(r->str->data, pr);
+            }
+            if(!((l->type == JSON_RAW ? pl : *l) == (r->type == JSON_RAW ? pr : *r))){
+                return false;
+            }
+        }
+        else if(l->type != r->type){
+            return false;
+        }
+        else if(l->type == JSON_NUMBER){
+            bool equal;
+            if(l->kind == Value::NUMBER_RAW || r->kind == Value::NUMBER_RAW){
+                equal = (l->kind == Value::NUMBER_RAW ? l->parse_raw_number() : *l) ==
+                        (r->kind == Value::NUMBER_RAW ? r->parse_raw_number() : *r);
+            }
+            else if(l->kind != Value::NUMBER_DOUBLE && r->kind != Value::NUMBER_DOUBLE){
+                equal = l->kind == r->kind && l->i64 == r->i64;
+            }
+            else if(l->kind == Value::NUMBER_DOUBLE && r->kind == Value::NUMBER_DOUBLE){
+                equal = l->num == r->num;
+            }
+            else{
+                equal = l->kind == Value::NUMBER_DOUBLE ? number_equals(*r, l->num) : number_equals(*l, r->num);
+            }
+            if(!equal){
+                return false;
+            }
+        }
+        else if(l->type == JSON_STRING){
+            if(l->str != r->str && l->str->data != r->str->data){
+                return false;
+            }
+        }
+        else if(l->type == JSON_ARRAY && l->array != r->array){      // 指针相同时共享同一份数据
+            // 空数组的指针为nullptr
+            if(l->array == nullptr || r->array == nullptr){
+                if(l->get_array_size() != r->get_array_size()){
+                    return false;
+                }
+            }
+            else if(hash_differs(l->array->hash, r->array->hash) || l->array->data.size() != r->array->data.size()){
+                return false;
+            }
+            else{
+                stack.push_back(Frame{l, r, 0, {}});
+            }
+        }
+        else if(l->type == JSON_OBJECT && l->object != r->object){
+            if(l->object == nullptr || r->object == nullptr){
+                if(l->get_object_size() != r->get_object_size()){
+                    return false;
+                }
+            }
+            else if(hash_differs(l->object->hash, r->object->hash) || l->object->data.size() != r->object->data.size()){
+                return false;
+            }
+            else{
+                stack.push_back(Frame{l, r, 0, l->object->data.begin()});
+            }
+        }
+
+        /**********找到下一对要比较的值，弹出已比较完的容器***************/
+        while(1){
+            if(stack.empty()){
+                return true;
+            }
+            Frame &f = stack.back();
+            if(f.lhs->type == JSON_ARRAY){
+                if(f.index != f.lhs->array->data.size()){
+                    l = &f.lhs->array->data[f.index];
+                    r = &f.rhs->array->data[f.index];
+                    ++f.index;
+                    break;
+                }
+            }
+            else if(f.iter != f.lhs->object->data.end()){
+                auto found = f.rhs->object->data.find(f.iter->first);
+                if(found == f.rhs->object->data.end()){
+                    return false;
+                }
+                l = &f.iter->second;
+                r = &found->second;
+                ++f.iter;
+                break;
+            }
+            stack.pop_back();
+        }
     }
 }
 
@@ -983,11 +4862,25 @@ bool operator!=(const Value &lhs, const Value &rhs)
 std::ostream &operator<<(std::ostream &os, const Value &v)
 {
     if(v.type == JSON_NUMBER){
-        os << v.get_number();
+        if(v.is_raw_number()){
+            os << v.get_raw_number();
+        }
+        else if(v.is_int64()){
+            os << v.get_int64();
+        }
+        else if(v.is_uint64()){
+            os << v.get_uint64();
+        }
+        else{
+            os << v.get_number();
+        }
     }
     if(v.type == JSON_STRING){
         os << v.get_string();
     }
+    if(v.type == JSON_RAW){
+        os << v.get_raw_json();
+    }
     if(v.type == JSON_NULL){
         os << "NULL";
     }
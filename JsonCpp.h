@@ -11,6 +11,10 @@
 #include <unordered_map>
 #include <iostream>
 #include <utility>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <initializer_list>
 
 namespace JsonCpp
 {
@@ -24,7 +28,8 @@ enum value_type
     JSON_NUMBER,
     JSON_STRING,
     JSON_ARRAY,
-    JSON_OBJECT
+    JSON_OBJECT,
+    JSON_RAW            // 已序列化的JSON片段，生成时原样复制
 };
 
 /****************结果返回值**************/
@@ -45,15 +50,106 @@ enum
     PARSE_MISS_COLON,
     PARSE_MISS_COMMA_OR_CURLY_BRACKET,
     OBJECT_KEY_NOT_EXIST,
-    GENERATE_OK
+    GENERATE_OK,
+    PARSE_INVALID_UTF8,         // 字符串中含有非法UTF-8序列
+    PARSE_UNEXPECTED_END,       // 二进制数据被截断
+    SNAPSHOT_VERSION_MISMATCH,  // 快照格式版本(或字节序)不一致
+    SNAPSHOT_CORRUPTED,         // 快照大小或校验和错误
+    SNAPSHOT_IO_ERROR,          // 文件读写失败
+    PARSE_TYPE_MISMATCH,        // 绑定到C++类型时JSON值的类型不符
+    PARSE_DEPTH_EXCEEDED,       // 数组/对象嵌套过深
+    GENERATE_INVALID_UTF8,      // 输出的字符串中含有非法UTF-8序列
+    STREAM_END,                 // 流中没有更多文档
+    STREAM_IO_ERROR,            // 读取流失败
+    GENERATE_SIZE_EXCEEDED,     // 字符串长度或元素个数超出二进制格式的32位上限
+    STREAM_DOCUMENT_TOO_LARGE   // 流中单个文档超过max_document_size
 };
 
 class Parser;
 class Generator;
+class Projection;
+class MsgPackWriter;
+class MsgPackReader;
+class SnapshotWriter;
+
+/****************格式化选项**************/
+struct FormatOptions
+{
+    unsigned indent = 4;            // 每层缩进的字符数，0表示不换行
+    char indent_char = ' ';         // 缩进字符，' '或'\t'
+    bool space_after_colon = true;  // ':'后加空格
+    bool space_after_comma = false; // ','后加空格(仅indent为0时有效，否则','后换行)
+    const char *newline = "\n";     // 换行符，"\n"或"\r\n"
+};
+
+struct ParseOptions
+{
+    size_t max_depth = 1024;        // 数组/对象最多嵌套的层数，超过时返回PARSE_DEPTH_EXCEEDED
+    bool validate_utf8 = false;     // 检查字符串的UTF-8编码，非法时返回PARSE_INVALID_UTF8
+    bool raw_numbers = false;       // 数字保存为原始文本，用到时才转换，生成时原样输出；不检查是否超出double范围
+    size_t max_document_size = 64 * 1024 * 1024;   // 只用于StreamReader：单个文档的最大字节数
+};
+
+/****************输出时非法UTF-8的处理**************/
+enum utf8_handling
+{
+    UTF8_KEEP,          // 原样输出，不检查
+    UTF8_VALIDATE,      // 返回GENERATE_INVALID_UTF8
+    UTF8_REPLACE        // 每个非法字节替换为U+FFFD
+};
+
+struct GenerateOptions
+{
+    bool pretty = false;            // 为false时紧凑输出，忽略format
+    FormatOptions format;
+    bool cache_fragments = false;   // 在数组/对象节点上缓存输出片段，再次生成时未修改的子树直接复制
+    utf8_handling invalid_utf8 = UTF8_KEEP;
+    bool ensure_ascii = false;      // 非ASCII字符输出为\uXXXX，输出只含ASCII字符
+};
+
+class Value;
+
+// Generator缓存在节点上的输出片段，key标识生成选项和缩进层次。
+// 子树中有exposed的节点时，stamp记录安装时每个直接子节点的状态，使用前逐个核对
+struct Fragment
+{
+    uint64_t key;
+    std::string text;
+    uint64_t serial;                // 全局唯一，父节点的stamp据此确认子节点的片段没有被删除重建
+    std::vector<uint64_t> stamp;    // 每个子节点两项，为空表示不需要核对
+};
+
+// 引用计数的共享数据。复制Value时只增加计数；修改前若数据被共享，
+// 先复制一份再修改(写时复制)，因此复制整棵树是O(1)的。
+template<typename T>
+struct Shared
+{
+    std::atomic<long> refs;
+    std::atomic<uint64_t> hash;             // 缓存的结构哈希，0表示尚未计算
+    std::atomic<Fragment *> fragment;       // 缓存的输出片段，仅数组和对象使用
+    // 曾交出过元素的非const引用/指针：之后元素可能不经过本节点被修改。
+    // 本节点及其祖先的哈希不再缓存(由子节点的哈希重新合并)，
+    // 输出片段仍然缓存，但每次使用前要核对直接子节点(见Fragment::stamp)。
+    // 无法知道引用何时不再使用，标记不会清除；经引用修改后核对失败的旧片段
+    // 可能正被其他线程读取，在本节点被修改(此时只有一个持有者)之前不会被替换
+    std::atomic<bool> exposed;
+    T data;
+
+    explicit Shared(const T &d) : refs(1), hash(0), fragment(nullptr), exposed(false), data(d) {}
+    explicit Shared(T &&d) : refs(1), hash(0), fragment(nullptr), exposed(false), data(std::move(d)) {}
+    ~Shared() { delete fragment.load(std::memory_order_relaxed); }
+};
+
+typedef Shared<std::string> SharedString;
+typedef Shared<std::vector<Value>> SharedArray;
+typedef Shared<std::unordered_map<std::string, Value>> SharedObject;
 
 class Value{
     friend Parser;
     friend Generator;
+    friend MsgPackWriter;
+    friend MsgPackReader;
+    friend SnapshotWriter;
     friend bool operator==(const Value &lhs, const Value &rhs);
     friend std::ostream &operator<<(std::ostream &os, const Value &v);
 private:
@@ -61,42 +157,102 @@ private:
 
     // union中不要带有包含构造函数的类型（string，vector等等）
     // 否则在构造的时候编译器会很迷茫
+    // 数字的存储方式：没有小数和指数部分的数字在64位整数范围内时保存为整数，
+    // 不超过INT64_MAX的整数总是保存为NUMBER_INT64
+    enum number_kind : unsigned char
+    {
+        NUMBER_DOUBLE,
+        NUMBER_INT64,
+        NUMBER_UINT64,
+        NUMBER_RAW          // 原始文本，保存在str中
+    };
+    number_kind kind = NUMBER_DOUBLE;   // 只对JSON_NUMBER有意义
+
+    // 数字直接保存在Value中；
+    // 字符串、数组和对象的数据可能被多个Value共享，空数组/空对象为nullptr
     union{
-        std::string* str;
-        double* num;
-        std::vector<Value>* array;
-        std::unordered_map<std::string, Value>* object;
+        SharedString* str;
+        double num;
+        int64_t i64;
+        uint64_t u64;
+        SharedArray* array;
+        SharedObject* object;
     };
+
+    void share(const Value &v);
+    void release_container(std::vector<Value> &pending);
+    // expose为true表示返回的引用会交给调用者，见Shared::exposed
+    std::vector<Value> &mutable_array(bool expose = false);
+    std::unordered_map<std::string, Value> &mutable_object(bool expose = false);
+    void set_raw_number(const char *s, size_t len);
+    Value parse_raw_number() const;
 public:
-    Value() : type(JSON_NULL){}
+    Value() : type(JSON_NULL), str(nullptr){}
     Value(const Value &v);
     Value(const double num);
     Value(const std::string &str);
     Value(Value &&v) noexcept;
+    ~Value() { free(); }
 
     void set_null();
     void set_true();
     void set_false();
     void set_number(double n);
+    void set_int64(int64_t n);
+    void set_uint64(uint64_t n);
     void set_string(const std::string &s);
+    void set_array();                   // 置为空数组
+    void set_object();                  // 置为空对象
     int get_type() const;
 
-    std::vector<Value> get_array();
+    // 非const的访问函数会使共享的数据先被复制，得到的指针/引用在复制
+    // 所在的Value之后不应再用于修改
+    std::vector<Value> get_array() const;
     int get_array_size() const;
-    Value* get_array_element(size_t index) const;
+    const Value* get_array_element(size_t index) const;
+    Value* get_array_element(size_t index);
     void erase_array_element(size_t index, size_t count);
     void clear_array();
-    void insert_array_element(Value &v, size_t index);
+    void insert_array_element(const Value &v, size_t index);   // index可以等于大小，即追加
+    void insert_array_element(Value &&v, size_t index);
+    void push_back(const Value &v);
+    void push_back(Value &&v);
+    template<typename... Args>
+    Value &emplace_back(Args&&... args)
+    {
+        std::vector<Value> &a = mutable_array(true);
+        a.emplace_back(std::forward<Args>(args)...);
+        return a.back();
+    }
+    void reserve(size_t n);             // 数组或对象预留n个元素的空间
 
-    std::unordered_map<std::string, Value> get_object();
+    std::unordered_map<std::string, Value> get_object() const;
     int get_object_size() const;
     bool find_object_value(const std::string &key) const;
-    Value *get_object_value(const std::string &key) const;
-    void set_object_value(const std::string &key, Value &v);
+    const Value *get_object_value(const std::string &key) const;
+    Value *get_object_value(const std::string &key);
+    void set_object_value(const std::string &key, const Value &v);
+    void set_object_value(const std::string &key, Value &&v);
+    // 键已存在时替换值，否则插入；返回对象中的值
+    Value &insert_or_assign(const std::string &key, const Value &v);
+    Value &insert_or_assign(std::string &&key, Value &&v);
     void remove_object_value(const std::string &key);
-    
+    bool is_shared() const;             // 数据是否与其他Value共享
+    // 稳定的结构哈希：只取决于内容，与平台、进程和对象中键的顺序无关，
+    // 数组和对象的结果缓存在节点上，经非const访问后失效
+    uint64_t hash() const;
 
-    double get_number() const;
+
+    double get_number() const;          // 整数转换为double
+    bool is_int64() const;              // 是否为int64范围内的整数(不含1.0这样写成小数的数字)
+    bool is_uint64() const;             // 是否为uint64范围内的非负整数
+    int64_t get_int64() const;          // 整数原样返回，小数截断
+    uint64_t get_uint64() const;
+    bool is_raw_number() const;         // 是否以ParseOptions::raw_numbers解析得到的原始文本保存
+    const std::string &get_raw_number() const;
+    // 保存已序列化的JSON片段(JSON_RAW)。validate为true时先校验，不合法时返回错误码且不修改自身
+    int set_raw_json(const std::string &json, bool validate = true);
+    const std::string &get_raw_json() const;
     std::string get_string() const;
     void free();
 
@@ -106,11 +262,17 @@ public:
     Value& operator=(Value &&rhs) noexcept;
     Value& operator[](size_t index);
     Value& operator[](const std::string &s);
+    const Value& operator[](size_t index) const;
+    const Value& operator[](const std::string &s) const;
 };
 
 class Buffer{
     friend Parser;
     friend Generator;
+    friend MsgPackWriter;
+    friend class Emitter;
+    friend class Writer;
+    friend class Context;
 private:
     char *stack = nullptr;
     size_t size = 0;
@@ -121,16 +283,73 @@ public:
     void put_char(char ch);
     void put_string(const char* s, int len);
     void clear();
+    void swap(Buffer &b);
+    size_t capacity() const { return size; }
     ~Buffer() { clear(); }
 };
 
+/****************路径投影**************/
+// 预编译一组JSON Pointer路径(RFC 6901)，解析时只为命中的子树构造Value，
+// 其余部分仅做语法扫描，不解码字符串、不转换数字。
+class Projection{
+    friend Parser;
+private:
+    struct Node{
+        std::vector<std::pair<std::string, int>> children;  // 路径片段 -> 子节点下标
+        std::vector<long> indexes;                          // 片段对应的数组下标，非数字为-1
+        int slot = -1;                                      // 命中时写入的结果下标
+    };
+    std::vector<Node> nodes;
+    size_t slots = 0;
+
+    int find_child(int node, const char *key, size_t len) const;
+    int find_child(int node, size_t index) const;
+public:
+    Projection() : nodes(1) {}
+    int add(const std::string &pointer);
+    size_t size() const { return slots; }
+};
+
+/****************已知键集合**************/
+// 一组固定的键。构造时搜索种子生成完美哈希表(不同的键落在不同的槽中)，
+// 之后lookup只需一次哈希和一次比较即可把键映射到它在集合中的下标，
+// 供Reader在扫描时直接匹配输入中的键，不必构造std::string。
+class KeySet{
+private:
+    std::vector<std::string> keys;
+    std::vector<int> table;         // 槽 -> 键的下标，-1为空槽
+    uint32_t seed = 0;
+    uint32_t mask = 0;
+
+    static uint32_t hash(const char *s, size_t len, uint32_t seed);
+    void build();
+public:
+    KeySet(std::initializer_list<const char *> keys);
+    explicit KeySet(const std::vector<std::string> &keys);
+    int lookup(const char *s, size_t len) const;    // 不在集合中时返回-1，重复的键取第一个
+    int lookup(const std::string &key) const { return lookup(key.data(), key.length()); }
+    size_t size() const { return keys.size(); }
+    const std::string &key(size_t id) const { return keys[id]; }
+};
+
 class Parser{
+    friend class Reader;
+    friend class Context;
+    friend class StreamReader;
     friend int Json_Parse(const std::string &json, Value &value);
+    friend int Json_Parse(const std::string &json, Value &value, const ParseOptions &options);
+    friend int Json_Parse_Projection(const std::string &json, const Projection &projection,
+                                     std::vector<Value> &values, std::vector<bool> *found);
+    friend int Json_Validate(const std::string &json, const ParseOptions &options, size_t *error_offset);
 
 private:
     const std::string &json;
     size_t pos;
     Buffer buf;
+    bool check_number_range = false;    // skip_*时是否检查数字越界
+    bool check_utf8 = false;            // 是否检查字符串的UTF-8编码
+    bool raw_numbers = false;           // parse_number只保存原始文本
+    size_t max_depth = ParseOptions().max_depth;
 
     Parser(const std::string &s):json(s), pos(0) {}
     int run(Value &v);
@@ -140,37 +359,471 @@ private:
     int parse_string(Value &v);
     int parse_string_raw(std::string &s);
     int parse_number(Value &v);
+    int parse_number_raw(double &d);
+    bool parse_integer(size_t head, Value &v);
+    int convert_number(size_t head, double &d);
+    int scan_number();
     bool parse_hex4(unsigned &u);
     void encode_utf8(unsigned u);
-    int parse_array(Value &v);
-    int parse_object(Value &v);
+    int parse_scalar(Value &v);
+    int parse_key(std::string &key);
+
+    int skip_value();
+    int skip_string();
+    int skip_number();
+    int skip_scalar();
+    int skip_key();
+    int select_value(const Projection &p, int node, std::vector<Value> &values, std::vector<bool> &found);
+    int select_array(const Projection &p, int node, std::vector<Value> &values, std::vector<bool> &found);
+    int select_object(const Projection &p, int node, std::vector<Value> &values, std::vector<bool> &found);
+    void select_from(const Projection &p, int node, const Value &v, std::vector<Value> &values, std::vector<bool> &found);
 
     inline bool ISDIGIT09(char ch){ return ch >= '1' && ch <= '9';}
     inline bool ISDIGIT(char ch){return ch >= '0' && ch <= '9';}
 };
 
 class Generator{
+    friend class Context;
     friend int Json_Generate(std::string &json, const Value &value);
+    friend int Json_Generate(std::string &json, const Value &value, const GenerateOptions &options);
 private:
     std::string &json;
     size_t pos = 0;
     Buffer buf;
+    GenerateOptions options;
 
     Generator(std::string &s) : json(s) {}
+    Generator(std::string &s, const GenerateOptions &o) : json(s), options(o) {}
+    int run(const Value &v);
+    int stringify_value(const Value &v, size_t depth);
+    void install_fragment(const Value &v, size_t depth, size_t head, bool stamped);
+    static bool stamp_children(const Value &v, std::vector<uint64_t> &stamp,
+                               std::vector<std::pair<const Value *, const Fragment *>> *stamped);
+    static bool fragment_current(const Value &v, const Fragment *f);
+    uint64_t fragment_key(size_t depth);
+    int stringify_string(const std::string &s);
+    void put_newline(size_t depth);
+    void put_comma(size_t depth);
+    void put_colon();
+};
+
+/****************MessagePack**************/
+class MsgPackWriter{
+    friend int MsgPack_Encode(std::string &out, const Value &value);
+private:
+    std::string &out;
+    Buffer buf;
+
+    MsgPackWriter(std::string &s) : out(s) {}
+    int run(const Value &v);
+    int pack_value(const Value &root);
+    void pack_number(double n);
+    void pack_int64(int64_t i);
+    void pack_uint64(uint64_t u);
+    void pack_string(const std::string &s);
+    void pack_header(unsigned char fix, size_t fix_max, unsigned char tag16, size_t n);
+    void put_be(unsigned char tag, unsigned long long u, size_t bytes);
+};
+
+class MsgPackReader{
+    friend int MsgPack_Decode(const char *data, size_t len, Value &value);
+private:
+    const unsigned char *p;
+    const unsigned char *end;
+    size_t depth = 0;
+    size_t max_depth = ParseOptions().max_depth;
+
+    MsgPackReader(const char *data, size_t len)
+        : p((const unsigned char *)data), end((const unsigned char *)data + len) {}
+    int run(Value &v);
+    int unpack_value(Value &v);
+};
+
+// 直接在MessagePack数据上做只读访问，字符串不拷贝，指向原始数据。
+// 访问出错(数据非法或越界)时得到的视图get_type()返回-1。
+class MsgPackView{
+private:
+    const unsigned char *p = nullptr;
+    const unsigned char *end = nullptr;
+
+    MsgPackView(const unsigned char *b, const unsigned char *e) : p(b), end(e) {}
+    static const unsigned char *skip(const unsigned char *p, const unsigned char *end);
+    const unsigned char *items(size_t &n) const;
+public:
+    MsgPackView() {}
+    MsgPackView(const char *data, size_t len)
+        : p((const unsigned char *)data), end((const unsigned char *)data + len) {}
+
+    int get_type() const;
+    double get_number() const;
+    bool get_string(const char *&s, size_t &len) const;
+    size_t size() const;
+    MsgPackView operator[](size_t index) const;
+    MsgPackView operator[](const std::string &key) const;
+};
+
+/****************二进制快照**************/
+// 快照是解析后的Value树的二进制镜像：所有引用都是相对文件开头的偏移，
+// 可以直接mmap后通过SnapshotValue只读访问，不需要反序列化。
+class SnapshotWriter{
+    friend int Json_Snapshot(std::string &out, const Value &value);
+private:
+    std::string &out;
+
+    SnapshotWriter(std::string &s) : out(s) {}
     int run(const Value &v);
-    int stringify_value(const Value &v);
-    void stringify_string(const Value &v);
+    int write_node(size_t at, const Value &root);
+    size_t reserve(size_t n);
+    size_t append(const std::string &s);
+};
+
+class SnapshotValue{
+    friend class Snapshot;
+private:
+    const char *base = nullptr;
+    size_t length = 0;          // 整个快照的大小，用于越界检查
+    size_t node = 0;            // 节点的偏移
+
+    SnapshotValue(const char *b, size_t len, size_t n) : base(b), length(len), node(n) {}
+    bool read_node(unsigned &type, unsigned &count, unsigned long long &payload) const;
+    SnapshotValue child(unsigned long long offset) const;
+public:
+    SnapshotValue() {}
+
+    int get_type() const;
+    double get_number() const;          // 不是数字或越界时返回0
+    int64_t get_int64() const;          // 与Value::get_int64相同，不是数字或越界时返回0
+    uint64_t get_uint64() const;
+    bool get_string(const char *&s, size_t &len) const;
+    size_t size() const;
+    SnapshotValue operator[](size_t index) const;
+    SnapshotValue operator[](const std::string &key) const;
+};
+
+class Snapshot{
+private:
+    const char *data = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    std::string storage;        // 无法mmap或刚重建时持有数据
+
+    int check(bool verify) const;
+public:
+    Snapshot() {}
+    Snapshot(const Snapshot &) = delete;
+    Snapshot &operator=(const Snapshot &) = delete;
+    ~Snapshot() { close(); }
+
+    int open(const std::string &path, bool verify = true);
+    int open_or_build(const std::string &path, const std::string &json_path, bool verify = true);
+    int load(const char *buffer, size_t len, bool verify = true);
+    void close();
+    SnapshotValue root() const;
+};
+
+/****************结构体绑定**************/
+// 拉取式读取器：按调用者期望的结构逐个读取值，不构造Value。
+// 结构体绑定(JsonBind.h)用它把JSON直接解析到C++对象中。
+class Reader{
+private:
+    Parser parser;
+
+    int next_key(size_t index, bool &more);
+    int after_key();
+public:
+    explicit Reader(const std::string &json) : parser(json) { parser.parse_whitespace(); }
+    Reader(const std::string &&) = delete;     // 只保存引用，不能绑定临时对象
+
+    int peek();                         // 下一个值的类型，输入结束时返回-1
+    int read_null();
+    int read(bool &b);
+    int read(double &d);
+    int read(int64_t &i);               // 数字不是整数或超出范围时返回PARSE_TYPE_MISMATCH
+    int read(uint64_t &u);
+    int read(std::string &s);
+    int read(Value &v);
+    int skip();
+
+    // 读入'['或'{'；之后每次调用*_next前进到下一个元素/键值对，
+    // index为已读取的个数，没有更多元素时more为false并读入']'或'}'
+    int begin_array();
+    int array_next(size_t index, bool &more);
+    int begin_object();
+    int object_next(size_t index, std::string &key, bool &more);
+    // 同上，但把键直接映射为keys中的下标(未知的键为-1)，不含转义的键不做任何复制
+    int object_next(size_t index, const KeySet &keys, int &id, bool &more);
+
+    int finish();                       // 检查之后只剩空白
+};
+
+// 直接输出JSON文本，与Generator共用字符串转义和数字格式化
+class Emitter{
+private:
+    std::string &json;
+    Buffer buf;
+public:
+    explicit Emitter(std::string &s) : json(s) {}
+
+    void put_char(char ch);
+    void put_raw(const char *s, size_t len);
+    void put_string(const char *s, size_t len);     // 加引号并转义
+    void put_number(double n);
+    void put_int64(int64_t i);
+    void put_uint64(uint64_t u);
+    void finish();                                  // 把已输出的内容追加到json
+};
+
+/****************流式输出**************/
+// 不构造Value，按调用顺序直接输出JSON文本，逗号、冒号和缩进(options.pretty)自动加入，
+// 与Generator共用字符串转义和数字格式化。每个字段不分配内存。
+// 调试版本用assert检查调用顺序：对象中每个值之前必须先调用key，容器必须配对关闭，顶层只有一个值。
+// 输出到ostream时缓冲的内容每64KB写出一次；finish输出剩余内容后可以继续写下一个文档。
+class Writer{
+private:
+    struct Level{
+        bool object;
+        size_t count;                   // 已输出的元素/键值对个数
+    };
+    std::string *json = nullptr;
+    std::ostream *os = nullptr;
+    Buffer buf;
+    GenerateOptions options;
+    std::vector<Level> stack;
+    bool after_key = false;
+    bool done = false;                  // 已输出顶层值
+    int error = GENERATE_OK;
+
+    void before_value();
+    void before_element();
+    void after_value();
+    void start(bool object);
+    void end(bool object);
+public:
+    explicit Writer(std::string &s, const GenerateOptions &o = GenerateOptions()) : json(&s), options(o) {}
+    explicit Writer(std::ostream &s, const GenerateOptions &o = GenerateOptions()) : os(&s), options(o) {}
+
+    void start_object();
+    void end_object();
+    void start_array();
+    void end_array();
+    void key(const char *s, size_t len);
+    void key(const char *s);
+    void key(const std::string &s);
+    void string(const char *s, size_t len);
+    void string(const char *s);
+    void string(const std::string &s);
+    void number(double n);
+    void int64(int64_t i);
+    void uint64(uint64_t u);
+    void boolean(bool b);
+    void null();
+    void raw(const char *s, size_t len);    // 已序列化的JSON片段，原样输出
+    int finish();                           // 返回GENERATE_OK，或字符串的UTF-8检查失败时的错误码
+};
+
+/****************多文档流**************/
+// 从std::istream或文件描述符读取以空白(如换行)分隔的多个JSON文档，每次next返回一个。
+// 输入按window_size分块读入同一个窗口，已返回的文档占用的空间在下次读入时回收，
+// 占用的内存只取决于最大的单个文档，与流的长度无关。
+// 某个文档有语法错误时next返回错误码并跳过这个文档，之后可以继续读取。
+// 文档超过options.max_document_size时返回STREAM_DOCUMENT_TOO_LARGE，丢弃到下一个换行为止。
+// prefetch为true时由后台线程读入下一块(双缓冲)，读取与解析重叠；
+// 析构时等待读线程结束，从管道等读取时可能阻塞到有数据或流结束。
+class StreamReader{
+private:
+    struct Prefetch;
+
+    std::istream *is = nullptr;
+    int fd = -1;
+    size_t chunk;
+    ParseOptions options;
+    bool overlapped;
+    Prefetch *prefetch = nullptr;
+    std::string window;                 // 尚未返回的输入
+    size_t consumed = 0;                // 已从窗口中移除的字节数
+    size_t begin = 0;                   // 下一个文档(含前导空白)在窗口中的位置
+    bool eof = false;
+    bool resync = false;                // 正在丢弃过大的文档，直到下一个换行
+
+    // 文档边界的扫描状态，读入更多数据后从scan处继续，已扫描的部分不重复扫描
+    size_t scan = 0;
+    size_t start = 0;                   // 文档第一个字符的位置
+    size_t depth = 0;
+    bool started = false;
+    bool in_string = false;
+    bool escape = false;
+
+    long read_block(char *dst, size_t n);
+    int fill();
+    bool find_end(size_t &end);
+    void skip_document(size_t end);
+public:
+    explicit StreamReader(std::istream &s, size_t window_size = 64 * 1024,
+                          const ParseOptions &o = ParseOptions(), bool prefetch = false)
+        : is(&s), chunk(window_size ? window_size : 1), options(o), overlapped(prefetch) {}
+    explicit StreamReader(int file, size_t window_size = 64 * 1024,
+                          const ParseOptions &o = ParseOptions(), bool prefetch = false)
+        : fd(file), chunk(window_size ? window_size : 1), options(o), overlapped(prefetch) {}
+    StreamReader(const StreamReader &) = delete;
+    StreamReader &operator=(const StreamReader &) = delete;
+    ~StreamReader();
+
+    int next(Value &v);                 // 返回PARSE_OK、解析错误码、STREAM_END、STREAM_IO_ERROR或STREAM_DOCUMENT_TOO_LARGE
+    size_t offset() const { return consumed + begin; }     // 已返回的文档之后在流中的位置
+    size_t capacity() const { return window.capacity(); }
 };
 
+/****************可重用的上下文**************/
+// 每次调用Json_Parse/Json_Generate都从空的Buffer开始逐步扩容，用完即释放。
+// Context在多次调用之间保留缓冲区，只有容量超过trim_threshold时才在调用结束后释放。
+// 同一个Context不能被多个线程同时使用，Context::local()返回当前线程的实例。
+class Context{
+private:
+    Buffer parse_buf;
+    Buffer generate_buf;
+    size_t trim_threshold;
+
+    void finish(Buffer &buf);
+public:
+    explicit Context(size_t trim_threshold = 1 << 20) : trim_threshold(trim_threshold) {}
+
+    int parse(const std::string &json, Value &value);
+    int parse(const std::string &json, Value &value, const ParseOptions &options);
+    int generate(std::string &json, const Value &value);
+    int generate(std::string &json, const Value &value, const GenerateOptions &options);
+
+    void set_trim_threshold(size_t n) { trim_threshold = n; }
+    void trim();                        // 立即释放保留的缓冲区
+    size_t capacity() const { return parse_buf.capacity() + generate_buf.capacity(); }
+
+    static Context &local();
+};
+
+/****************可原子替换的共享文档**************/
+// 多个线程读取、运行时整体替换的文档(如配置)。读者不加锁：read()只在本线程所在的一组
+// 计数器上加减一次，不同线程分散在不同的缓存行上；store/reload先在调用者线程中准备好新文档，
+// 再原子地替换，等待所有可能仍在读取旧文档的读者结束(宽限期)后释放旧文档。
+// 写者之间互斥。持有Guard的线程不能在同一个文档上调用store/reload，否则会一直等待自己。
+class SharedDocument{
+private:
+    static const unsigned STRIPES = 32;
+    struct alignas(64) Stripe{          // 每个计数独占一条缓存行
+        std::atomic<long> readers[2];   // 按epoch的奇偶分开计数
+    };
+
+    std::atomic<Value *> current;
+    std::atomic<unsigned> epoch;
+    std::atomic<uint64_t> versions;
+    mutable Stripe stripes[STRIPES];
+    std::mutex write_lock;
+
+    void wait_readers(unsigned parity);
+public:
+    // 读取期间持有，析构后不能再使用得到的引用
+    class Guard{
+        friend class SharedDocument;
+    private:
+        std::atomic<long> *counter;
+        const Value *value;
+        Guard(std::atomic<long> *c, const Value *v) : counter(c), value(v) {}
+    public:
+        Guard(Guard &&g) noexcept : counter(g.counter), value(g.value) { g.counter = nullptr; }
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+        ~Guard() { if(counter != nullptr) counter->fetch_sub(1); }
+        const Value &operator*() const { return *value; }
+        const Value *operator->() const { return value; }
+    };
+
+    SharedDocument() : SharedDocument(Value()) {}
+    explicit SharedDocument(Value v);
+    SharedDocument(const SharedDocument &) = delete;
+    SharedDocument &operator=(const SharedDocument &) = delete;
+    ~SharedDocument();                  // 调用者保证此时没有读者
+
+    Guard read() const;
+    Value load() const;                 // 复制当前文档(O(1))，可以长期持有；频繁调用时各线程会竞争根节点的引用计数
+    void store(Value v);
+    int reload(const std::string &json, const ParseOptions &options = ParseOptions());  // 解析失败时不替换
+    uint64_t version() const { return versions.load(); }   // 已替换的次数
+};
+
+/****************性能剖析**************/
+// 以-DJSONCPP_PROFILE编译时，Parser/Generator按阶段记录次数、耗时(纳秒)和处理的字节数，
+// 并把每次解析/生成的耗时记入直方图。统计按线程分开保存，不需要加锁。
+// 未定义JSONCPP_PROFILE时计时点全部展开为空，Profile_Snapshot返回全0的结果。
+enum profile_stage
+{
+    PROFILE_PARSE,                  // 整次解析，字节数为输入长度
+    PROFILE_PARSE_STRING,           // parse_string_raw(含键)
+    PROFILE_PARSE_NUMBER,           // parse_number/parse_number_raw
+    PROFILE_PARSE_CONTAINER,        // 次数为数组/对象的个数，耗时为解析中除字符串和数字以外的部分
+    PROFILE_GENERATE,               // 整次生成，字节数为输出长度
+    PROFILE_STRINGIFY_STRING,
+    PROFILE_STRINGIFY_NUMBER,
+    PROFILE_STRINGIFY_CONTAINER,    // 同PROFILE_PARSE_CONTAINER
+    PROFILE_BUFFER_GROW,            // Buffer扩容，字节数为增加的容量
+    PROFILE_STAGE_COUNT
+};
+
+struct ProfileCounter
+{
+    uint64_t count = 0;
+    uint64_t nanos = 0;
+    uint64_t bytes = 0;
+};
+
+// 桶i记录耗时在[2^i, 2^(i+1))纳秒内的调用
+struct LatencyHistogram
+{
+    uint64_t buckets[64] = {};
+    uint64_t count = 0;
+
+    void record(uint64_t nanos);
+    uint64_t percentile(double p) const;        // p在0~1之间，返回所在桶的上界
+    void merge(const LatencyHistogram &h);
+};
+
+struct ProfileSnapshot
+{
+    ProfileCounter stages[PROFILE_STAGE_COUNT];
+    LatencyHistogram parse_latency;
+    LatencyHistogram generate_latency;
+
+    void merge(const ProfileSnapshot &s);       // 合并其他线程的统计
+};
+
+ProfileSnapshot Profile_Snapshot();             // 当前线程的统计
+void Profile_Reset();
+
 
 bool operator==(const Value &lhs, const Value &rhs);
 bool operator!=(const Value &lhs, const Value &rhs);
+
+// 以Value为键的unordered_map/unordered_set使用的哈希
+struct ValueHash
+{
+    size_t operator()(const Value &v) const { return (size_t)v.hash(); }
+};
 std::ostream &operator<<(std::ostream &os, const Value &v);
 
 
 int Json_Parse(const std::string &json, Value &value);
+int Json_Parse(const std::string &json, Value &value, const ParseOptions &options);
+int Json_Parse_Projection(const std::string &json, const Projection &projection,
+                          std::vector<Value> &values, std::vector<bool> *found = nullptr);
+int Json_Validate(const std::string &json, size_t *error_offset = nullptr);
+int Json_Validate(const std::string &json, const ParseOptions &options, size_t *error_offset = nullptr);
 int Json_Generate(std::string &json, const Value &value);
+int Json_Generate(std::string &json, const Value &value, const GenerateOptions &options);
 void Json_Print(std::ostream &os, const std::string &json);
+int Json_Snapshot(std::string &out, const Value &value);        // 覆盖out原有内容
+int Json_Write_Snapshot(const std::string &path, const Value &value);
+int MsgPack_Encode(std::string &out, const Value &value);
+int MsgPack_Decode(const char *data, size_t len, Value &value);
+int MsgPack_Decode(const std::string &data, Value &value);
+void Json_Minify(std::string &out, const std::string &json);
+void Json_Pretty(std::string &out, const std::string &json, const FormatOptions &options = FormatOptions());
 
 }  // namespace JsonCpp
 #endif
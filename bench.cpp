@@ -0,0 +1,636 @@
+/*
+*
+*
+*       JsonCpp性能测试
+*
+*
+*/
+#include "JsonCpp.h"
+#include "JsonBind.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace JsonCpp;
+using namespace std;
+
+struct BenchUser
+{
+    int id;
+    vector<string> tags;
+    int score;
+};
+JSONCPP_FIELDS(BenchUser, id, tags, score)
+
+struct BenchEvent
+{
+    long long id;
+    string type;
+    bool ok;
+    double ts;
+    BenchUser user;
+    vector<int> items;
+    Value extra;
+};
+JSONCPP_FIELDS(BenchEvent, id, type, ok, ts, user, items, extra)
+
+/*********************测试数据*********************/
+
+// 数字为主的数组
+static string make_numbers(size_t n)
+{
+    string json = "[";
+    char tmp[32];
+    for (size_t i = 0; i != n; ++i){
+        if(i % 3){
+            snprintf(tmp, sizeof(tmp), "%zu", (size_t)(i * 7919));
+        }
+        else{
+            snprintf(tmp, sizeof(tmp), "%.6f", i * 0.37);
+        }
+        json += tmp;
+        json += i + 1 != n ? "," : "]";
+    }
+    return json;
+}
+
+// 字符串为主的对象数组
+static string make_strings(size_t n)
+{
+    string json = "[";
+    for (size_t i = 0; i != n; ++i){
+        json += "{\"name\":\"user_" + to_string(i) + "\",\"email\":\"user" + to_string(i) +
+                "@example.com\",\"bio\":\"Lorem ipsum dolor sit amet, consectetur adipiscing elit\"}";
+        json += i + 1 != n ? "," : "]";
+    }
+    return json;
+}
+
+// 嵌套的事件记录
+static string make_events(size_t n)
+{
+    string json = "[";
+    for (size_t i = 0; i != n; ++i){
+        json += "{\"id\":" + to_string(100000 + i) + ",\"type\":\"click\",\"ok\":true,\"ts\":" +
+                to_string(1545523200 + i * 13) + ".25,\"user\":{\"id\":" + to_string(i % 97) +
+                ",\"tags\":[\"a\",\"b\",\"c\"],\"score\":" + to_string(i % 1000) +
+                "},\"items\":[1,2,3,4,5,6,7,8],\"extra\":null}";
+        json += i + 1 != n ? "," : "]";
+    }
+    return json;
+}
+
+struct Corpus{
+    const char *name;
+    string json;
+};
+
+static vector<Corpus> corpora()
+{
+    vector<Corpus> ret;
+    ret.push_back(Corpus{"numbers", make_numbers(20000)});
+    ret.push_back(Corpus{"strings", make_strings(2000)});
+    ret.push_back(Corpus{"events", make_events(1000)});
+    return ret;
+}
+
+/*********************计时*********************/
+
+// 重复执行f，返回单次耗时(微秒)的最小值
+template<typename F>
+static double measure(F f, int rounds = 20)
+{
+    double best = 1e300;
+    for (int i = 0; i != rounds; ++i){
+        auto start = chrono::steady_clock::now();
+        f();
+        auto end = chrono::steady_clock::now();
+        double us = chrono::duration<double, micro>(end - start).count();
+        if(us < best){
+            best = us;
+        }
+    }
+    return best;
+}
+
+static void report(const char *corpus, const char *what, size_t bytes, double us)
+{
+    cout << left << setw(10) << corpus << setw(18) << what << right << setw(10) << bytes << " B"
+         << setw(12) << fixed << setprecision(1) << us << " us"
+         << setw(10) << setprecision(1) << bytes / us << " MB/s" << endl;
+}
+
+/*********************MessagePack*********************/
+
+static void bench_msgpack()
+{
+    cout << "== JSON vs MessagePack ==" << endl;
+    for(auto & c : corpora()){
+        Value v;
+        Json_Parse(c.json, v);
+        string json, bin;
+        Json_Generate(json, v);
+        MsgPack_Encode(bin, v);
+
+        report(c.name, "Json_Parse", c.json.size(), measure([&]{ Value t; Json_Parse(c.json, t); t.free(); }));
+        report(c.name, "MsgPack_Decode", bin.size(), measure([&]{ Value t; MsgPack_Decode(bin, t); t.free(); }));
+        report(c.name, "Json_Generate", json.size(), measure([&]{ string s; Json_Generate(s, v); }));
+        report(c.name, "MsgPack_Encode", bin.size(), measure([&]{ string s; MsgPack_Encode(s, v); }));
+    }
+}
+
+/*********************快照*********************/
+
+static void bench_snapshot()
+{
+    cout << "== Json_Parse vs Snapshot::open ==" << endl;
+    for(auto & c : corpora()){
+        Value v;
+        Json_Parse(c.json, v);
+        string bin;
+        Json_Snapshot(bin, v);
+        Json_Write_Snapshot("bench_snapshot.bin", v);
+
+        report(c.name, "Json_Parse", c.json.size(), measure([&]{ Value t; Json_Parse(c.json, t); t.free(); }));
+        report(c.name, "Snapshot::open", bin.size(), measure([&]{
+            Snapshot snap;
+            snap.open("bench_snapshot.bin", false);
+            snap.root()[0].get_type();
+        }));
+        report(c.name, "open + checksum", bin.size(), measure([&]{
+            Snapshot snap;
+            snap.open("bench_snapshot.bin", true);
+        }));
+    }
+    remove("bench_snapshot.bin");
+}
+
+/*********************结构体绑定*********************/
+
+static void bench_bind()
+{
+    cout << "== Json_Parse vs Json_Parse_Into ==" << endl;
+    Corpus c = corpora()[2];
+    vector<BenchEvent> events;
+    Json_Parse_Into(c.json, events);
+    string json;
+    Json_Generate_From(json, events);
+
+    report(c.name, "Json_Parse", c.json.size(), measure([&]{ Value t; Json_Parse(c.json, t); t.free(); }));
+    report(c.name, "Json_Parse_Into", c.json.size(), measure([&]{ vector<BenchEvent> t; Json_Parse_Into(c.json, t); }));
+    report(c.name, "Json_Generate_From", json.size(), measure([&]{ string s; Json_Generate_From(s, events); }));
+}
+
+/*********************复制*********************/
+
+static void bench_copy()
+{
+    cout << "== Value copy (copy-on-write) ==" << endl;
+    for(auto & c : corpora()){
+        Value v;
+        Json_Parse(c.json, v);
+        report(c.name, "copy", c.json.size(), measure([&]{ Value t(v); }));
+        report(c.name, "copy + modify", c.json.size(), measure([&]{ Value t(v); t[0] = 1.0; }));
+    }
+}
+
+/*********************输出片段缓存*********************/
+
+static void bench_fragment_cache()
+{
+    cout << "== Json_Generate with cached fragments ==" << endl;
+    GenerateOptions cached;
+    cached.cache_fragments = true;
+    for(auto & c : corpora()){
+        Value v;
+        Json_Parse(c.json, v);
+        string json;
+        Json_Generate(json, v, cached);
+
+        report(c.name, "Json_Generate", json.size(), measure([&]{ string s; Json_Generate(s, v); }));
+        report(c.name, "cached, 1 change", json.size(), measure([&]{
+            v[0] = v[0];        // 使第一个元素和根节点的片段失效
+            string s;
+            Json_Generate(s, v, cached);
+        }));
+    }
+}
+
+/*********************可重用的上下文*********************/
+
+static void bench_context()
+{
+    cout << "== small messages: Json_Parse/Generate vs Context ==" << endl;
+    vector<string> messages;
+    for (size_t i = 0; i != 1000; ++i){
+        messages.push_back("{\"id\":" + to_string(i) + ",\"method\":\"user.update\",\"params\":{\"name\":\"user_" +
+                           to_string(i) + "\",\"note\":\"Lorem ipsum dolor sit amet, consectetur adipiscing\"}}");
+    }
+    size_t bytes = 0;
+    for(auto & m : messages){
+        bytes += m.size();
+    }
+    Value v;
+    Json_Parse(messages[0], v);
+    string out;
+    Json_Generate(out, v);
+    Context &ctx = Context::local();
+
+    report("1000 msgs", "Json_Parse", bytes, measure([&]{ for(auto & m : messages){ Value t; Json_Parse(m, t); } }));
+    report("1000 msgs", "Context::parse", bytes, measure([&]{ for(auto & m : messages){ Value t; ctx.parse(m, t); } }));
+    report("1000 msgs", "Json_Generate", out.size() * 1000, measure([&]{
+        for (int i = 0; i != 1000; ++i){ string s; Json_Generate(s, v); } }));
+    report("1000 msgs", "Context::generate", out.size() * 1000, measure([&]{
+        string s;
+        for (int i = 0; i != 1000; ++i){ s.clear(); ctx.generate(s, v); } }));
+}
+
+/*********************数字原样转发*********************/
+
+static void bench_raw_numbers()
+{
+    cout << "== parse + generate: converted vs raw numbers ==" << endl;
+    ParseOptions raw;
+    raw.raw_numbers = true;
+    vector<Corpus> all = corpora();
+    for(auto & c : all){
+        if(c.name == string("strings")){
+            continue;
+        }
+        report(c.name, "converted", c.json.size(), measure([&]{
+            Value t;
+            Json_Parse(c.json, t);
+            string s;
+            Json_Generate(s, t);
+        }));
+        report(c.name, "raw_numbers", c.json.size(), measure([&]{
+            Value t;
+            Json_Parse(c.json, t, raw);
+            string s;
+            Json_Generate(s, t);
+        }));
+    }
+}
+
+/*********************嵌入已序列化的片段*********************/
+
+static void bench_raw_json()
+{
+    cout << "== response assembly: parse + embed vs JSON_RAW ==" << endl;
+    vector<string> parts;
+    size_t bytes = 0;
+    string slots = "[";
+    for (int i = 0; i != 200; ++i){
+        parts.push_back(make_events(5));
+        bytes += parts.back().size();
+        slots += i != 199 ? "null," : "null]";
+    }
+    report("200 parts", "parse + embed", bytes, measure([&]{
+        Value doc;
+        Json_Parse(slots, doc);
+        for (size_t i = 0; i != parts.size(); ++i){
+            Json_Parse(parts[i], doc[i]);
+        }
+        string s;
+        Json_Generate(s, doc);
+    }));
+    report("200 parts", "JSON_RAW", bytes, measure([&]{
+        Value doc;
+        Json_Parse(slots, doc);
+        for (size_t i = 0; i != parts.size(); ++i){
+            doc[i].set_raw_json(parts[i], false);
+        }
+        string s;
+        Json_Generate(s, doc);
+    }));
+}
+
+/*********************多文档流*********************/
+
+// NDJSON：StreamReader分块读入 vs 按行Json_Parse
+static void bench_stream()
+{
+    cout << "== NDJSON stream ==" << endl;
+    string ndjson;
+    for (int i = 0; i != 2000; ++i){
+        ndjson += make_events(2) + "\n";
+    }
+    report("ndjson", "getline+Json_Parse", ndjson.size(), measure([&]{
+        istringstream is(ndjson);
+        string line;
+        Value v;
+        while (getline(is, line)){
+            Json_Parse(line, v);
+        }
+    }));
+    report("ndjson", "StreamReader", ndjson.size(), measure([&]{
+        istringstream is(ndjson);
+        StreamReader reader(is);
+        Value v;
+        while (reader.next(v) == PARSE_OK){
+        }
+    }));
+
+    // 从文件加载：先整体读入再逐行解析 vs 读线程预读下一块、与解析重叠
+    const char *path = "bench_stream.ndjson";
+    string file;
+    while (file.size() < 16 * 1024 * 1024){
+        file += ndjson;
+    }
+    ofstream(path, ios::binary) << file;
+    report("file", "read, then parse", file.size(), measure([&]{
+        ifstream in(path, ios::binary);
+        string all((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        Value v;
+        size_t begin = 0, end;
+        while ((end = all.find('\n', begin)) != string::npos){
+            Json_Parse(all.substr(begin, end - begin), v);
+            begin = end + 1;
+        }
+    }, 5));
+#ifndef _WIN32
+    for (int prefetch = 0; prefetch != 2; ++prefetch){
+        report("file", prefetch ? "Stream+prefetch" : "StreamReader", file.size(), measure([&]{
+            int fd = open(path, O_RDONLY);
+            StreamReader reader(fd, 1024 * 1024, ParseOptions(), prefetch != 0);
+            Value v;
+            while (reader.next(v) == PARSE_OK){
+            }
+            close(fd);
+        }, 5));
+    }
+#endif
+    remove(path);
+}
+
+/*********************构造文档*********************/
+
+// 程序构造n个{"id":i,"name":"..."}：逐个push_back/insert_or_assign vs 逐个解析后按下标赋值
+static void bench_build()
+{
+    cout << "== building documents ==" << endl;
+    const size_t n = 100000;
+    string slots = "[";
+    for (size_t i = 0; i != n; ++i){
+        slots += i + 1 != n ? "null," : "null]";
+    }
+    report("100k objs", "parse + assign", n, measure([&]{
+        Value doc;
+        Json_Parse(slots, doc);
+        for (size_t i = 0; i != n; ++i){
+            Value item;
+            Json_Parse("{\"id\":0,\"name\":\"\"}", item);
+            item["id"].set_int64(i);
+            item["name"].set_string("user");
+            doc[i] = item;
+        }
+    }, 5));
+    report("100k objs", "push_back", n, measure([&]{
+        Value doc;
+        doc.set_array();
+        doc.reserve(n);
+        for (size_t i = 0; i != n; ++i){
+            Value &item = doc.emplace_back();
+            item.set_object();
+            item.reserve(2);
+            Value id;
+            id.set_int64(i);
+            item.insert_or_assign(string("id"), move(id));
+            item.insert_or_assign(string("name"), Value(string("user")));
+        }
+    }, 5));
+}
+
+/*********************流式输出*********************/
+
+// 与make_events相同的内容：Writer直接输出 vs 从解析好的Value生成
+static void bench_writer()
+{
+    cout << "== streaming Writer vs Json_Generate ==" << endl;
+    const size_t n = 1000;
+    string json = make_events(n);
+    Value doc;
+    Json_Parse(json, doc);
+    static const char *tags[] = {"a", "b", "c"};
+    report("events", "Json_Generate", json.size(), measure([&]{ string s; Json_Generate(s, doc); }));
+    report("events", "Writer", json.size(), measure([&]{
+        string s;
+        Writer w(s);
+        w.start_array();
+        for (size_t i = 0; i != n; ++i){
+            w.start_object();
+            w.key("id");
+            w.int64(100000 + i);
+            w.key("type");
+            w.string("click");
+            w.key("ok");
+            w.boolean(true);
+            w.key("ts");
+            w.number(1545523200 + i * 13 + 0.25);
+            w.key("user");
+            w.start_object();
+            w.key("id");
+            w.int64(i % 97);
+            w.key("tags");
+            w.start_array();
+            for (int t = 0; t != 3; ++t){
+                w.string(tags[t]);
+            }
+            w.end_array();
+            w.key("score");
+            w.int64(i % 1000);
+            w.end_object();
+            w.key("items");
+            w.start_array();
+            for (int k = 1; k <= 8; ++k){
+                w.int64(k);
+            }
+            w.end_array();
+            w.key("extra");
+            w.null();
+            w.end_object();
+        }
+        w.end_array();
+        w.finish();
+    }));
+}
+
+/*********************共享文档*********************/
+
+// 多个线程读取配置中的一个字段，同时后台线程每毫秒重新加载一次：
+// 互斥锁保护的Value vs SharedDocument
+static void bench_shared_document()
+{
+    cout << "== shared config: mutex vs SharedDocument ==" << endl;
+    const string config = make_events(20);
+    const int reads = 200000;
+    for (int threads = 1; threads <= 8; threads *= 2){
+        mutex lock;
+        Value locked;
+        Json_Parse(config, locked);
+        SharedDocument shared;
+        shared.reload(config);
+        for (int mode = 0; mode != 2; ++mode){
+            atomic<bool> done(false);
+            thread reloader([&]{
+                while (!done.load()){
+                    Value next;
+                    Json_Parse(config, next);
+                    if (mode == 0){
+                        lock_guard<mutex> guard(lock);
+                        locked = move(next);
+                    }
+                    else{
+                        shared.store(move(next));
+                    }
+                    this_thread::sleep_for(chrono::milliseconds(1));
+                }
+            });
+            atomic<long long> sum(0);
+            auto start = chrono::steady_clock::now();
+            vector<thread> readers;
+            for (int t = 0; t != threads; ++t){
+                readers.push_back(thread([&]{
+                    long long local = 0;
+                    for (int i = 0; i != reads; ++i){
+                        if (mode == 0){
+                            lock_guard<mutex> guard(lock);
+                            const Value &c = locked;
+                            local += c[i % 20]["id"].get_int64();
+                        }
+                        else{
+                            SharedDocument::Guard g = shared.read();
+                            local += (*g)[i % 20]["id"].get_int64();
+                        }
+                    }
+                    sum += local;
+                }));
+            }
+            for (auto & t : readers){
+                t.join();
+            }
+            double us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+            done = true;
+            reloader.join();
+            cout << left << setw(10) << (to_string(threads) + " thr") << setw(18) << (mode == 0 ? "mutex" : "SharedDocument")
+                 << right << setw(12) << fixed << setprecision(1) << threads * (double)reads / us << " Mreads/s" << endl;
+        }
+    }
+}
+
+/*********************UTF-8检查*********************/
+
+static void bench_utf8()
+{
+    cout << "== UTF-8 validation / ensure_ascii ==" << endl;
+    vector<Corpus> all;
+    all.push_back(corpora()[1]);
+    string cjk = "[";
+    for (int i = 0; i != 2000; ++i){
+        cjk += "{\"name\":\"\xE7\x94\xA8\xE6\x88\xB7_" + to_string(i) +
+               "\",\"bio\":\"\xE8\xBF\x99\xE6\x98\xAF\xE4\xB8\x80\xE6\xAE\xB5\xE4\xB8\xAD\xE6\x96\x87 text \xF0\x9F\x98\x80\"},";
+    }
+    cjk += "0]";
+    all.push_back(Corpus{"cjk", cjk});
+    ParseOptions strict;
+    strict.validate_utf8 = true;
+    GenerateOptions checked;
+    checked.invalid_utf8 = UTF8_VALIDATE;
+    GenerateOptions ascii;
+    ascii.ensure_ascii = true;
+    for(auto & c : all){
+        Value v;
+        Json_Parse(c.json, v);
+        string json;
+        Json_Generate(json, v);
+
+        report(c.name, "Json_Parse", c.json.size(), measure([&]{ Value t; Json_Parse(c.json, t); }));
+        report(c.name, "validate_utf8", c.json.size(), measure([&]{ Value t; Json_Parse(c.json, t, strict); }));
+        report(c.name, "Json_Generate", json.size(), measure([&]{ string s; Json_Generate(s, v); }));
+        report(c.name, "UTF8_VALIDATE", json.size(), measure([&]{ string s; Json_Generate(s, v, checked); }));
+        report(c.name, "ensure_ascii", json.size(), measure([&]{ string s; Json_Generate(s, v, ascii); }));
+    }
+}
+
+/*********************解析/生成/校验*********************/
+
+static void bench_core()
+{
+    cout << "== Json_Parse / Json_Generate / Json_Validate ==" << endl;
+    vector<Corpus> all = corpora();
+    string nested = "[";
+    for (int i = 0; i != 2000; ++i){
+        nested += "{\"a\":[[[{\"b\":[1,[2,[3,{\"c\":[4]}]]]}]]]},";
+    }
+    nested += "0]";
+    all.push_back(Corpus{"nested", nested});
+    for(auto & c : all){
+        Value v;
+        Json_Parse(c.json, v);
+        string json;
+        Json_Generate(json, v);
+
+        report(c.name, "Json_Parse", c.json.size(), measure([&]{ Value t; Json_Parse(c.json, t); }));
+        report(c.name, "Json_Generate", json.size(), measure([&]{ string s; Json_Generate(s, v); }));
+        report(c.name, "Json_Validate", c.json.size(), measure([&]{ Json_Validate(c.json); }));
+    }
+}
+
+/*********************分阶段统计*********************/
+
+#ifdef JSONCPP_PROFILE
+static void profile_report()
+{
+    static const char *names[PROFILE_STAGE_COUNT] = {
+        "parse", "  string", "  number", "  container",
+        "generate", "  string", "  number", "  container", "buffer grow"
+    };
+    ProfileSnapshot s = Profile_Snapshot();
+    cout << "== profile ==" << endl;
+    for (int i = 0; i != PROFILE_STAGE_COUNT; ++i){
+        const ProfileCounter &c = s.stages[i];
+        cout << left << setw(14) << names[i] << right << setw(12) << c.count << " calls"
+             << setw(12) << fixed << setprecision(1) << c.nanos / 1e6 << " ms"
+             << setw(14) << c.bytes << " B" << endl;
+    }
+    cout << "parse latency    p50 < " << s.parse_latency.percentile(0.5) << " ns, p99 < "
+         << s.parse_latency.percentile(0.99) << " ns" << endl;
+    cout << "generate latency p50 < " << s.generate_latency.percentile(0.5) << " ns, p99 < "
+         << s.generate_latency.percentile(0.99) << " ns" << endl;
+}
+#endif
+
+int main()
+{
+    bench_core();
+    bench_msgpack();
+    bench_snapshot();
+    bench_bind();
+    bench_copy();
+    bench_fragment_cache();
+    bench_context();
+    bench_utf8();
+    bench_raw_numbers();
+    bench_raw_json();
+    bench_writer();
+    bench_build();
+    bench_stream();
+    bench_shared_document();
+#ifdef JSONCPP_PROFILE
+    profile_report();
+#endif
+    return 0;
+}
@@ -6,12 +6,48 @@
 * 
 */
 #include "JsonCpp.h"
+#include "JsonBind.h"
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+#include <cmath>
+#include <thread>
 
 using namespace JsonCpp;
 using namespace std;
 
+struct BindUser
+{
+    int id;
+    std::string name;
+    std::vector<std::string> tags;
+};
+JSONCPP_FIELDS(BindUser, id, name, tags)
+
+struct BindEvent
+{
+    long long id;
+    double ts;
+    bool ok;
+    BindUser user;
+    std::vector<int> items;
+    JsonCpp::Optional<std::string> note;
+    std::vector<BindUser> children;
+};
+JSONCPP_FIELDS(BindEvent, id, ts, ok, user, items, note, children)
+
+struct BindIds
+{
+    long long id;
+    unsigned long long big;
+    short small;
+};
+JSONCPP_FIELDS(BindIds, id, big, small)
+
 static int test_count = 0;
 static int test_pass = 0;
 
@@ -447,6 +483,101 @@ static void test_operator()
     } */
 }
 
+static void test_parse_projection()
+{
+    const string json =
+        " { "
+        "\"id\" : 42 , "
+        "\"skip\" : { \"a\" : [ 1, \"x\\u0041\", { } ], \"b\" : null }, "
+        "\"user\" : { \"name\" : \"abc\", \"tags\" : [ \"t0\", \"t1\" ] }, "
+        "\"k\\u0065y\" : true, "
+        "\"a/b\" : 1.5 "
+        " } ";
+    Projection p;
+    CHECK(0, p.add("/id"));
+    CHECK(1, p.add("/user/name"));
+    CHECK(2, p.add("/user/tags/1"));
+    CHECK(3, p.add("/missing"));
+    CHECK(4, p.add("/key"));
+    CHECK(5, p.add("/a~1b"));
+    CHECK(6, p.add("/user"));
+    CHECK(1, p.add("/user/name"));
+    CHECK(-1, p.add("id"));
+    CHECK(-1, p.add("/a~2"));
+    CHECK(7, (int)p.size());
+
+    vector<Value> values;
+    vector<bool> found;
+    CHECK(PARSE_OK, Json_Parse_Projection(json, p, values, &found));
+    CHECK(7, (int)values.size());
+    CHECK(42.0, values[0].get_number());
+    CHECK("abc", values[1].get_string());
+    CHECK("t1", values[2].get_string());
+    CHECK(false, (bool)found[3]);
+    CHECK(JSON_NULL, values[3].get_type());
+    CHECK(JSON_TRUE, values[4].get_type());
+    CHECK(1.5, values[5].get_number());
+    CHECK(JSON_OBJECT, values[6].get_type());
+    CHECK(2, values[6].get_object_size());
+
+    /* 被跳过的部分仍然做完整的语法检查 */
+    Projection q;
+    q.add("/id");
+    CHECK(PARSE_MISS_COMMA_OR_SQUARE_BRACKET, Json_Parse_Projection("{\"x\":[1 2],\"id\":1}", q, values));
+    CHECK(JSON_NULL, values[0].get_type());
+    CHECK(PARSE_INVALID_STRING_ESCAPE, Json_Parse_Projection("{\"x\":\"\\v\",\"id\":1}", q, values));
+    CHECK(PARSE_INVALID_UNICODE_SURROGATE, Json_Parse_Projection("{\"x\":\"\\uD800\",\"id\":1}", q, values));
+    CHECK(PARSE_INVALID_VALUE, Json_Parse_Projection("{\"x\":1.,\"id\":1}", q, values));
+    CHECK(PARSE_MISS_QUOTATION_MARK, Json_Parse_Projection("{\"x\":\"abc", q, values));
+    CHECK(PARSE_ROOT_NOT_SINGULAR, Json_Parse_Projection("{\"id\":1} x", q, values));
+    CHECK(PARSE_EXPECT_VALUE, Json_Parse_Projection(" ", q, values));
+
+    /* 空路径选取整个文档 */
+    Projection r;
+    CHECK(0, r.add(""));
+    CHECK(PARSE_OK, Json_Parse_Projection("[1,2,3]", r, values));
+    CHECK(3, values[0].get_array_size());
+}
+
+static void test_validate()
+{
+    /* Json_Validate与Json_Parse对同一输入应返回相同的错误码 */
+    const char *cases[] = {
+        "null", "false", "true", "nul", "?", "", " ", "null x", "0123", "0x0",
+        "-0", "1.5", "1E-10", "1e-10000", "1e309", "-1e309", "+1", ".123", "1.", "INF",
+        "\"Hello\\nWorld\"", "\"\\uD834\\uDD1E\"", "\"", "\"abc", "\"\\v\"", "\"\\x12\"",
+        "\"\x01\"", "\"\x1F\"", "\"\\u012\"", "\"\\uG000\"", "\"\\uD800\"", "\"\\uD800\\uE000\"",
+        "[ null , false , true , 123 , \"abc\" ]", "[1", "[1}", "[1 2", "[[]",
+        "{\"a\" : [ 1, 2, { } ], \"b\" : { \"c\" : \"d\" } }",
+        "{:1,", "{1:1,", "{\"a\"}", "{\"a\",\"b\"}", "{\"a\":1", "{\"a\":1]", "{\"a\":{}",
+        "\"a long string that crosses more than one sixteen byte block \\t and keeps going\"",
+    };
+    for(size_t i = 0; i != sizeof(cases) / sizeof(cases[0]); ++i){
+        Value v;
+        CHECK(Json_Parse(cases[i], v), Json_Validate(cases[i]));
+    }
+
+    size_t offset;
+    CHECK(PARSE_OK, Json_Validate("[1, 2]", &offset));
+    CHECK((size_t)6, offset);
+    CHECK(PARSE_MISS_COMMA_OR_SQUARE_BRACKET, Json_Validate("[1, 2 3]", &offset));
+    CHECK((size_t)6, offset);
+    CHECK(PARSE_ROOT_NOT_SINGULAR, Json_Validate("{} {}", &offset));
+    CHECK((size_t)3, offset);
+
+    /* UTF-8检查 */
+    ParseOptions utf8;
+    utf8.validate_utf8 = true;
+    CHECK(PARSE_OK, Json_Validate("\"\xE2\x82\xAC \xF0\x9D\x84\x9E \xC2\xA2\"", utf8));
+    CHECK(PARSE_OK, Json_Validate("\"\xC0\xAF\""));
+    CHECK(PARSE_INVALID_UTF8, Json_Validate("\"\xC0\xAF\"", utf8, &offset));      /* 过长编码 */
+    CHECK((size_t)1, offset);
+    CHECK(PARSE_INVALID_UTF8, Json_Validate("\"\xED\xA0\x80\"", utf8));  /* 代理区 */
+    CHECK(PARSE_INVALID_UTF8, Json_Validate("\"\xF4\x90\x80\x80\"", utf8)); /* 超过U+10FFFF */
+    CHECK(PARSE_INVALID_UTF8, Json_Validate("\"abc\x80\"", utf8));
+    CHECK(PARSE_INVALID_UTF8, Json_Validate("[\"\xE2\x82\"]", utf8));
+}
+
 static void test_parse()
 {
     test_parse_literal();
@@ -478,6 +609,9 @@ static void test_parse()
     test_access_object();
 
     test_operator();
+
+    test_parse_projection();
+    test_validate();
 }
 
 static void test_stringify_number()
@@ -524,6 +658,54 @@ static void test_stringify_object() {
 }
 
 
+static void test_stringify_pretty()
+{
+    Value v;
+    string json;
+    GenerateOptions options;
+    CHECK(PARSE_OK, Json_Parse("{\"a\":[1,[],{},\"x,y:\"],\"b\":{\"c\":null}}", v));
+
+    /* 默认选项与紧凑输出相同 */
+    string compact;
+    Json_Generate(compact, v);
+    CHECK(GENERATE_OK, Json_Generate(json, v, options));
+    CHECK(compact, json);
+
+    /* 与先生成再格式化的结果一致 */
+    options.pretty = true;
+    options.format.indent = 2;
+    string expect;
+    Json_Pretty(expect, compact, options.format);
+    json.clear();
+    CHECK(GENERATE_OK, Json_Generate(json, v, options));
+    CHECK(expect, json);
+
+    options.format.indent = 1;
+    options.format.indent_char = '\t';
+    options.format.newline = "\r\n";
+    options.format.space_after_colon = false;
+    json.clear();
+    CHECK(PARSE_OK, Json_Parse("[1,{\"k\":[true]}]", v));
+    Json_Generate(json, v, options);
+    CHECK("[\r\n\t1,\r\n\t{\r\n\t\t\"k\":[\r\n\t\t\ttrue\r\n\t\t]\r\n\t}\r\n]", json);
+    options.format.newline = "";
+    json.clear();
+    CHECK(GENERATE_OK, Json_Generate(json, v, options));
+    CHECK("[\t1,\t{\t\t\"k\":[\t\t\ttrue\t\t]\t}]", json);
+    options.format.newline = "\r\n";
+
+    /* indent为0时单行输出，只加空格 */
+    options.format.indent = 0;
+    options.format.space_after_colon = true;
+    options.format.space_after_comma = true;
+    json.clear();
+    Json_Generate(json, v, options);
+    CHECK("[1, {\"k\": [true]}]", json);
+    expect.clear();
+    Json_Pretty(expect, "[1,{\"k\":[true]}]", options.format);
+    CHECK(expect, json);
+}
+
 static void test_stringify() {
     CHECK_ROUNDTRIP("null");
     CHECK_ROUNDTRIP("false");
@@ -532,6 +714,7 @@ static void test_stringify() {
     test_stringify_string();
     test_stringify_array();
     test_stringify_object();
+    test_stringify_pretty();
 }
 
 static void test_print()
@@ -543,6 +726,1486 @@ static void test_print()
     Json_Print(cout, json2);
 }
 
+static void test_format()
+{
+    const string json = " { \"a{,:\" : [ 1 , 2.5e3 , \"x\\\" ]\" ] ,\r\n\t\"b\" : { } , \"c\" : [ ] , \"d\" : { \"e\" : null } } ";
+    string out;
+    Json_Minify(out, json);
+    CHECK("{\"a{,:\":[1,2.5e3,\"x\\\" ]\"],\"b\":{},\"c\":[],\"d\":{\"e\":null}}", out);
+
+    /* 追加到已有内容之后 */
+    string appended = "#";
+    Json_Minify(appended, "[ \"a b\" ]");
+    CHECK("#[\"a b\"]", appended);
+
+    string pretty;
+    FormatOptions options;
+    options.indent = 2;
+    Json_Pretty(pretty, json, options);
+    CHECK("{\n"
+          "  \"a{,:\": [\n"
+          "    1,\n"
+          "    2.5e3,\n"
+          "    \"x\\\" ]\"\n"
+          "  ],\n"
+          "  \"b\": {},\n"
+          "  \"c\": [],\n"
+          "  \"d\": {\n"
+          "    \"e\": null\n"
+          "  }\n"
+          "}", pretty);
+
+    /* 格式化后再压缩应得到相同的结果 */
+    string again;
+    Json_Minify(again, pretty);
+    CHECK(out, again);
+
+    pretty.clear();
+    options.indent = 1;
+    options.indent_char = '\t';
+    Json_Pretty(pretty, "[1,[2]]", options);
+    CHECK("[\n\t1,\n\t[\n\t\t2\n\t]\n]", pretty);
+}
+
+#define CHECK_MSGPACK_ROUNDTRIP(json)          \
+    do                                        \
+    {                                         \
+        Value v, v2;                          \
+        std::string bin, json2;               \
+        CHECK(PARSE_OK, Json_Parse(json, v)); \
+        CHECK(GENERATE_OK, MsgPack_Encode(bin, v));   \
+        CHECK(PARSE_OK, MsgPack_Decode(bin, v2));     \
+        Json_Generate(json2, v2);             \
+        CHECK(json, json2);                   \
+    }while(0)
+
+static void test_msgpack()
+{
+    CHECK_MSGPACK_ROUNDTRIP("null");
+    CHECK_MSGPACK_ROUNDTRIP("false");
+    CHECK_MSGPACK_ROUNDTRIP("true");
+    CHECK_MSGPACK_ROUNDTRIP("0");
+    CHECK_MSGPACK_ROUNDTRIP("-0");
+    CHECK_MSGPACK_ROUNDTRIP("127");
+    CHECK_MSGPACK_ROUNDTRIP("-33");
+    CHECK_MSGPACK_ROUNDTRIP("65536");
+    CHECK_MSGPACK_ROUNDTRIP("-2147483649");
+    CHECK_MSGPACK_ROUNDTRIP("1.5");
+    CHECK_MSGPACK_ROUNDTRIP("1e+20");
+    CHECK_MSGPACK_ROUNDTRIP("-1.7976931348623157e+308");
+    CHECK_MSGPACK_ROUNDTRIP("\"\"");
+    CHECK_MSGPACK_ROUNDTRIP("\"Hello\\u0000World\"");
+    CHECK_MSGPACK_ROUNDTRIP("\"a string that is longer than thirty-one bytes\"");
+    CHECK_MSGPACK_ROUNDTRIP("[]");
+    CHECK_MSGPACK_ROUNDTRIP("[null,false,true,123,\"abc\",[1,2,3],[[],[[]]],1,2,3,4,5,6,7,8,9,10]");
+    CHECK_MSGPACK_ROUNDTRIP("{}");
+    CHECK_MSGPACK_ROUNDTRIP("{\"a\":{\"b\":[1,{\"c\":null}]}}");
+
+    /* 编码格式 */
+    Value v;
+    string bin;
+    Json_Parse("[1,-1,300,\"ab\"]", v);
+    MsgPack_Encode(bin, v);
+    CHECK(string("\x94\x01\xff\xcd\x01\x2c\xa2" "ab", 9), bin);
+
+    /* 错误处理 */
+    CHECK(PARSE_UNEXPECTED_END, MsgPack_Decode(string(""), v));
+    CHECK(JSON_NULL, v.get_type());
+    CHECK(PARSE_UNEXPECTED_END, MsgPack_Decode(string("\x92\x01", 2), v));
+    CHECK(PARSE_UNEXPECTED_END, MsgPack_Decode(string("\xa3" "ab", 3), v));
+    CHECK(PARSE_UNEXPECTED_END, MsgPack_Decode(string("\xdd\xff\xff\xff\xff", 5), v));
+    CHECK(PARSE_UNEXPECTED_END, MsgPack_Decode(string("\xcb\x00", 2), v));
+    CHECK(PARSE_INVALID_VALUE, MsgPack_Decode(string("\xc1", 1), v));
+    CHECK(PARSE_MISS_KEY, MsgPack_Decode(string("\x81\x01\x02", 3), v));
+    CHECK(PARSE_ROOT_NOT_SINGULAR, MsgPack_Decode(string("\xc0\xc0", 2), v));
+
+    /* 其他编码器产生的格式 */
+    CHECK(PARSE_OK, MsgPack_Decode(string("\xca\x3f\xc0\x00\x00", 5), v));
+    CHECK(1.5, v.get_number());
+    CHECK(PARSE_OK, MsgPack_Decode(string("\xd0\x80", 2), v));
+    CHECK(-128.0, v.get_number());
+    CHECK(PARSE_OK, MsgPack_Decode(string("\xc4\x02xy", 4), v));
+    CHECK("xy", v.get_string());
+
+    /* 零拷贝访问 */
+    bin.clear();
+    Json_Parse("{\"name\":\"abc\",\"list\":[1,{\"x\":[]},2.5],\"n\":null}", v);
+    MsgPack_Encode(bin, v);
+    MsgPackView view(bin.data(), bin.size());
+    CHECK(JSON_OBJECT, view.get_type());
+    CHECK(3, (int)view.size());
+    const char *s;
+    size_t len;
+    CHECK(true, view["name"].get_string(s, len));
+    CHECK("abc", string(s, len));
+    bool in_place = s >= bin.data() && s < bin.data() + bin.size();
+    CHECK(true, in_place);
+    CHECK(JSON_ARRAY, view["list"].get_type());
+    CHECK(2.5, view["list"][2].get_number());
+    CHECK(JSON_ARRAY, view["list"][1]["x"].get_type());
+    CHECK(JSON_NULL, view["n"].get_type());
+    CHECK(-1, view["missing"].get_type());
+    CHECK(-1, view["list"][3].get_type());
+    bin.clear();
+    Json_Parse("{\"n\":null}", v);
+    MsgPack_Encode(bin, v);
+    CHECK(JSON_NULL, MsgPackView(bin.data(), bin.size())["n"].get_type());
+    CHECK(-1, MsgPackView(bin.data(), bin.size() - 1)["n"].get_type());
+}
+
+static void test_snapshot()
+{
+    Value v;
+    CHECK(PARSE_OK, Json_Parse("{\"name\":\"abc\",\"list\":[1,{\"x\":[]},-2.5,\"\"],\"n\":null,"
+                               "\"t\":true,\"f\":false,\"o\":{},\"zz\":0,\"a\":\"Hello\\u0000World\"}", v));
+    string bin;
+    CHECK(GENERATE_OK, Json_Snapshot(bin, v));
+
+    Snapshot snap;
+    CHECK(PARSE_OK, snap.load(bin.data(), bin.size()));
+    SnapshotValue root = snap.root();
+    CHECK(JSON_OBJECT, root.get_type());
+    CHECK(8, (int)root.size());
+    const char *s;
+    size_t len;
+    CHECK(true, root["name"].get_string(s, len));
+    CHECK("abc", string(s, len));
+    CHECK(true, root["a"].get_string(s, len));
+    CHECK(string("Hello\0World", 11), string(s, len));
+    CHECK(JSON_ARRAY, root["list"].get_type());
+    CHECK(4, (int)root["list"].size());
+    CHECK(1.0, root["list"][0].get_number());
+    CHECK(-2.5, root["list"][2].get_number());
+    CHECK(JSON_ARRAY, root["list"][1]["x"].get_type());
+    CHECK(0, (int)root["list"][1]["x"].size());
+    CHECK(JSON_NULL, root["n"].get_type());
+    CHECK(JSON_TRUE, root["t"].get_type());
+    CHECK(JSON_FALSE, root["f"].get_type());
+    CHECK(JSON_OBJECT, root["o"].get_type());
+    CHECK(0.0, root["zz"].get_number());
+    CHECK(-1, root["missing"].get_type());
+    CHECK(-1, root["list"][4].get_type());
+    CHECK(-1, root["name"][0].get_type());
+    // 类型不符或越界时数字为0
+    CHECK(0.0, root["missing"].get_number());
+    CHECK(0, (int)root["name"].get_int64());
+    CHECK(0, (int)SnapshotValue().get_uint64());
+
+    /* 版本不一致与数据损坏 */
+    string bad = bin;
+    bad[4] = 99;
+    CHECK(SNAPSHOT_VERSION_MISMATCH, snap.load(bad.data(), bad.size()));
+    CHECK(-1, snap.root().get_type());
+    bad = bin;
+    bad[bad.size() - 1] ^= 1;
+    CHECK(SNAPSHOT_CORRUPTED, snap.load(bad.data(), bad.size()));
+    CHECK(PARSE_OK, snap.load(bad.data(), bad.size(), false));
+    CHECK(SNAPSHOT_CORRUPTED, snap.load(bin.data(), bin.size() - 8));
+
+    /* 文件：快照缺失或版本不一致时退回解析JSON并重建 */
+    const char *json_path = "snapshot_test.json";
+    const char *snap_path = "snapshot_test.bin";
+    remove(snap_path);
+    {
+        ofstream out(json_path);
+        out << "{\"config\":{\"threads\":8,\"name\":\"svc\"}}";
+    }
+    CHECK(SNAPSHOT_IO_ERROR, snap.open(snap_path));
+    CHECK(PARSE_OK, snap.open_or_build(snap_path, json_path));
+    CHECK(8.0, snap.root()["config"]["threads"].get_number());
+    snap.close();
+    CHECK(PARSE_OK, snap.open(snap_path));
+    CHECK(true, snap.root()["config"]["name"].get_string(s, len));
+    CHECK("svc", string(s, len));
+    snap.close();
+    {
+        fstream f(snap_path, ios::in | ios::out | ios::binary);
+        f.seekp(4);
+        f.put(9);
+    }
+    CHECK(SNAPSHOT_VERSION_MISMATCH, snap.open(snap_path));
+    CHECK(PARSE_OK, snap.open_or_build(snap_path, json_path));
+    CHECK(8.0, snap.root()["config"]["threads"].get_number());
+    snap.close();
+    CHECK(PARSE_OK, snap.open(snap_path));
+    snap.close();
+    remove(snap_path);
+    remove(json_path);
+}
+
+static void test_keyset()
+{
+    KeySet keys{"id", "name", "tags", "ts", "name"};
+    CHECK(0, keys.lookup("id"));
+    CHECK(1, keys.lookup("name"));
+    CHECK(2, keys.lookup("tags"));
+    CHECK(3, keys.lookup("ts"));
+    CHECK(-1, keys.lookup("t"));
+    CHECK(-1, keys.lookup("tagsx"));
+    CHECK(-1, keys.lookup(""));
+
+    KeySet none{};
+    CHECK(-1, none.lookup("id"));
+
+    vector<string> many;
+    for (int i = 0; i != 200; ++i){
+        many.push_back("field_" + to_string(i));
+    }
+    KeySet wide(many);
+    bool all = true;
+    for (int i = 0; i != 200; ++i){
+        all = all && wide.lookup(many[i]) == i;
+    }
+    CHECK(true, all);
+    CHECK(-1, wide.lookup("field_200"));
+
+    // 含转义的键先解码再查找
+    string json = "{\"n\\u0061me\" : 1, \"other\":[1,{}], \"ts\":2}";
+    Reader r(json);
+    int id;
+    bool more;
+    double d;
+    CHECK(PARSE_OK, r.begin_object());
+    CHECK(PARSE_OK, r.object_next(0, keys, id, more));
+    CHECK(1, id);
+    CHECK(PARSE_OK, r.read(d));
+    CHECK(PARSE_OK, r.object_next(1, keys, id, more));
+    CHECK(-1, id);
+    CHECK(PARSE_OK, r.skip());
+    CHECK(PARSE_OK, r.object_next(2, keys, id, more));
+    CHECK(3, id);
+    CHECK(PARSE_OK, r.read(d));
+    CHECK(PARSE_OK, r.object_next(3, keys, id, more));
+    CHECK(false, more);
+    CHECK(PARSE_OK, r.finish());
+
+    string bad_json = "{\"id\" 1}";
+    string unterminated_json = "{\"id";
+    Reader bad(bad_json);
+    CHECK(PARSE_OK, bad.begin_object());
+    CHECK(PARSE_MISS_COLON, bad.object_next(0, keys, id, more));
+    Reader unterminated(unterminated_json);
+    CHECK(PARSE_OK, unterminated.begin_object());
+    CHECK(PARSE_MISS_KEY, unterminated.object_next(0, keys, id, more));
+}
+
+static void test_bind()
+{
+    BindEvent e;
+    const char *json = "{\"id\":42,\"ts\":1.5,\"ok\":true,\"extra\":{\"a\":[1,2,{}]},"
+                       "\"user\":{\"id\":7,\"name\":\"Mazim\",\"tags\":[\"a\",\"b\"]},"
+                       "\"items\":[1,2,3],\"note\":null,\"children\":[{\"id\":1,\"name\":\"x\",\"tags\":[]}]}";
+    CHECK(PARSE_OK, Json_Parse_Into(json, e));
+    CHECK(42, e.id);
+    CHECK(1.5, e.ts);
+    CHECK(true, e.ok);
+    CHECK(7, e.user.id);
+    CHECK("Mazim", e.user.name);
+    CHECK((size_t)2, e.user.tags.size());
+    CHECK("b", e.user.tags[1]);
+    CHECK((size_t)3, e.items.size());
+    CHECK(3, e.items[2]);
+    CHECK(false, e.note.has_value);
+    CHECK((size_t)1, e.children.size());
+    CHECK("x", e.children[0].name);
+    CHECK((size_t)0, e.children[0].tags.size());
+
+    // 生成后再解析为Value，与直接解析的结果一致
+    string out;
+    e.note = string("hi\n");
+    CHECK(GENERATE_OK, Json_Generate_From(out, e));
+    Value v1, v2;
+    CHECK(PARSE_OK, Json_Parse(out, v1));
+    CHECK(PARSE_OK, Json_Parse("{\"id\":42,\"ts\":1.5,\"ok\":true,\"user\":{\"id\":7,\"name\":\"Mazim\","
+                               "\"tags\":[\"a\",\"b\"]},\"items\":[1,2,3],\"note\":\"hi\\n\","
+                               "\"children\":[{\"id\":1,\"name\":\"x\",\"tags\":[]}]}", v2));
+    bool same = v1 == v2;
+    CHECK(true, same);
+
+    // 缺省的Optional不输出
+    BindEvent e2 = e;
+    e2.note.has_value = false;
+    out.clear();
+    Json_Generate_From(out, e2);
+    CHECK(string::npos, out.find("note"));
+
+    // std::vector<bool>的元素是代理对象
+    vector<bool> flags;
+    CHECK(PARSE_OK, Json_Parse_Into("[true,false,true]", flags));
+    CHECK((size_t)3, flags.size());
+    CHECK(true, (bool)flags[0]);
+    CHECK(false, (bool)flags[1]);
+    out.clear();
+    CHECK(GENERATE_OK, Json_Generate_From(out, flags));
+    CHECK("[true,false,true]", out);
+    CHECK(PARSE_TYPE_MISMATCH, Json_Parse_Into("[true,1]", flags));
+
+    BindUser u;
+    CHECK(PARSE_TYPE_MISMATCH, Json_Parse_Into("{\"id\":1.5}", u));
+    CHECK(PARSE_TYPE_MISMATCH, Json_Parse_Into("{\"id\":1e10}", u));
+    CHECK(PARSE_TYPE_MISMATCH, Json_Parse_Into("{\"name\":1}", u));
+    CHECK(PARSE_TYPE_MISMATCH, Json_Parse_Into("[]", u));
+    CHECK(PARSE_MISS_COMMA_OR_CURLY_BRACKET, Json_Parse_Into("{\"id\":1 \"name\":\"a\"}", u));
+    CHECK(PARSE_ROOT_NOT_SINGULAR, Json_Parse_Into("{} 1", u));
+
+    vector<double> nums;
+    CHECK(PARSE_OK, Json_Parse_Into(" [ 1 , -2.5 , 3e2 ] ", nums));
+    CHECK((size_t)3, nums.size());
+    CHECK(300.0, nums[2]);
+}
+
+static void test_copy_on_write()
+{
+    Value a;
+    CHECK(PARSE_OK, Json_Parse("{\"list\":[1,2,[3]],\"name\":\"abc\",\"empty\":{}}", a));
+    Value b = a;
+    CHECK(true, a.is_shared());
+    CHECK(true, b.is_shared());
+
+    // const访问不复制
+    const Value &cb = b;
+    CHECK(3, cb["list"].get_array_size());
+    CHECK(true, b.is_shared());
+
+    // 修改b只复制被修改路径上的节点，a不受影响
+    b["list"][0] = 10.0;
+    CHECK(false, b.is_shared());
+    CHECK(1.0, a["list"][0].get_number());
+    CHECK(10.0, b["list"][0].get_number());
+    CHECK(true, a["list"][2].is_shared());
+
+    Value c = a;
+    c.set_object_value("name", Value(string("xyz")));
+    c.get_object_value("empty")->set_object_value("k", Value(1.0));
+    c.remove_object_value("list");
+    CHECK("abc", a["name"].get_string());
+    CHECK(0, a["empty"].get_object_size());
+    CHECK(true, a.find_object_value("list"));
+    CHECK("xyz", c["name"].get_string());
+    CHECK(1, c["empty"].get_object_size());
+    CHECK(false, c.find_object_value("list"));
+
+    Value d = a["list"];
+    d.erase_array_element(0, 1);
+    d.insert_array_element(Value(string("x")), 0);
+    CHECK(3, a["list"].get_array_size());
+    CHECK(1.0, a["list"][0].get_number());
+    CHECK("x", d[0].get_string());
+    d.clear_array();
+    CHECK(3, a["list"].get_array_size());
+
+    // 赋值为自身的子节点
+    Value e = a;
+    e = e["list"];
+    CHECK(JSON_ARRAY, e.get_type());
+    CHECK(3, e.get_array_size());
+    e = e[2][0];
+    CHECK(3.0, e.get_number());
+
+    bool same = a == Value(a);
+    CHECK(true, same);
+    a.free();
+    CHECK(JSON_OBJECT, b.get_type());
+    CHECK(10.0, b["list"][0].get_number());
+}
+
+static void test_hash()
+{
+    Value a, b, c;
+    CHECK(PARSE_OK, Json_Parse("{\"a\":1,\"b\":[true,null,\"x\"],\"c\":{\"d\":-0}}", a));
+    CHECK(PARSE_OK, Json_Parse("{\"c\":{\"d\":0},\"b\":[true,null,\"x\"],\"a\":1.0}", b));
+    CHECK(PARSE_OK, Json_Parse("{\"a\":1,\"b\":[null,true,\"x\"],\"c\":{\"d\":0}}", c));
+    CHECK(a.hash(), b.hash());
+    bool differ = a.hash() != c.hash();
+    CHECK(true, differ);
+    bool same = a == b;
+    CHECK(true, same);
+    same = a == c;
+    CHECK(false, same);
+
+    // 不同类型、键值互换的内容哈希不同
+    Value v1, v2, v3, v4;
+    Json_Parse("{\"a\":\"b\"}", v1);
+    Json_Parse("{\"b\":\"a\"}", v2);
+    Json_Parse("[\"1\"]", v3);
+    Json_Parse("[1]", v4);
+    differ = v1.hash() != v2.hash();
+    CHECK(true, differ);
+    differ = v3.hash() != v4.hash();
+    CHECK(true, differ);
+    differ = Value().hash() != Value(0.0).hash();
+    CHECK(true, differ);
+
+    // 与平台和进程无关
+    CHECK(2886850795691595219ull, Value(1.0).hash());
+
+    // 修改后缓存失效
+    uint64_t before = b.hash();
+    b["c"]["d"] = 2.0;
+    differ = b.hash() != before;
+    CHECK(true, differ);
+    same = a == b;
+    CHECK(false, same);
+    b["c"]["d"] = 0.0;
+    CHECK(before, b.hash());
+
+    // 去重
+    unordered_map<Value, int, ValueHash> seen;
+    seen[a]++;
+    seen[b]++;
+    seen[c]++;
+    CHECK((size_t)2, seen.size());
+    CHECK(2, seen[a]);
+
+    // 先取得引用，计算哈希后再通过引用修改：比较和哈希仍然正确
+    Value doc, fresh;
+    CHECK(PARSE_OK, Json_Parse("{\"k\":[1,2,9]}", doc));
+    CHECK(PARSE_OK, Json_Parse("{\"k\":[1,2,3]}", fresh));
+    Value &last = doc["k"][2];
+    Value *list = doc.get_object_value("k");
+    doc.hash();
+    fresh.hash();
+    last = 3.0;
+    same = doc == fresh;
+    CHECK(true, same);
+    CHECK(fresh.hash(), doc.hash());
+    list->push_back(Value(4.0));
+    same = doc == fresh;
+    CHECK(false, same);
+    list->erase_array_element(3, 1);
+    CHECK(fresh.hash(), doc.hash());
+}
+
+static void test_fragment_cache()
+{
+    Value v;
+    CHECK(PARSE_OK, Json_Parse("{\"a\":[1,2,{\"b\":\"x\"}],\"c\":{\"d\":[true,null]},\"e\":3}", v));
+    GenerateOptions cached;
+    cached.cache_fragments = true;
+    GenerateOptions pretty = cached;
+    pretty.pretty = true;
+    GenerateOptions plain_pretty;
+    plain_pretty.pretty = true;
+
+    string expect, first, second;
+    Json_Generate(expect, v);
+    CHECK(GENERATE_OK, Json_Generate(first, v, cached));
+    CHECK(GENERATE_OK, Json_Generate(second, v, cached));
+    CHECK(expect, first);
+    CHECK(expect, second);
+
+    // 缓存了紧凑格式的片段后，其他选项不会误用它
+    string p1, p2;
+    Json_Generate(p1, v, plain_pretty);
+    Json_Generate(p2, v, pretty);
+    CHECK(p1, p2);
+
+    // 修改叶子后，路径上的片段失效，其余片段被复用
+    v["a"][2]["b"] = string("y");
+    v["e"] = 4.0;
+    expect.clear();
+    second.clear();
+    Json_Generate(expect, v);
+    Json_Generate(second, v, cached);
+    CHECK(expect, second);
+    v["c"].set_object_value("f", Value(5.0));
+    expect.clear();
+    second.clear();
+    Json_Generate(expect, v);
+    Json_Generate(second, v, cached);
+    CHECK(expect, second);
+
+    // 副本共享片段，修改副本不影响原值的输出
+    Value w = v;
+    w["c"]["d"].erase_array_element(0, 1);
+    string from_v, from_w, expect_w;
+    Json_Generate(from_v, v, cached);
+    Json_Generate(from_w, w, cached);
+    Json_Generate(expect_w, w);
+    CHECK(second, from_v);
+    CHECK(expect_w, from_w);
+
+    // 先取得引用再生成，之后通过引用修改：祖先节点的片段核对不通过，不会被使用
+    Value doc;
+    CHECK(PARSE_OK, Json_Parse("{\"x\":{\"c\":0},\"y\":[1,2]}", doc));
+    Value &x = doc["x"];
+    for (int i = 1; i != 4; ++i){
+        string out;
+        CHECK(GENERATE_OK, Json_Generate(out, doc, cached));
+        Value check;
+        CHECK(PARSE_OK, Json_Parse(out, check));
+        CHECK(i - 1, (int)check["x"]["c"].get_int64());
+        x.set_object_value("c", Value((double)i));
+    }
+    Value *y = doc.get_object_value("y");
+    Value &elem = (*y)[0];
+    string out;
+    Json_Generate(out, doc, cached);
+    elem.set_number(9);
+    out.clear();
+    expect.clear();
+    Json_Generate(out, doc, cached);
+    Json_Generate(expect, doc);
+    CHECK(expect, out);
+    x.set_number(7);
+    out.clear();
+    expect.clear();
+    Json_Generate(out, doc, cached);
+    Json_Generate(expect, doc);
+    CHECK(expect, out);
+
+    // exposed的节点移入其他容器后，新的祖先的片段也要核对
+    Value items;
+    items.set_array();
+    Value &item = items.emplace_back(1.0);
+    Value holder;
+    CHECK(PARSE_OK, Json_Parse("{\"k\":null}", holder));
+    Value wrapper;
+    wrapper.set_array();
+    wrapper.push_back(move(holder));
+    wrapper.push_back(move(items));
+    out.clear();
+    Json_Generate(out, wrapper, cached);
+    item.set_number(2);
+    out.clear();
+    Json_Generate(out, wrapper, cached);
+    CHECK("[{\"k\":null},[2]]", out);
+
+    // exposed的节点仍然缓存片段，核对直接子节点未变即可复用：只有修改过的路径重新生成
+    Value edited;
+    CHECK(PARSE_OK, Json_Parse("{\"a\":{\"b\":1,\"n\":[1,2,3]},\"c\":{\"d\":[2]}}", edited));
+    edited["a"]["b"] = 5.0;
+    out.clear();
+    Json_Generate(out, edited, cached);
+    Value &d = edited["c"]["d"][0];
+    d = 6.0;
+    for (int i = 0; i != 3; ++i){
+        Profile_Reset();
+        out.clear();
+        expect.clear();
+        Json_Generate(out, edited, cached);
+#ifdef JSONCPP_PROFILE
+        // 只有d所在的路径重新生成，a核对通过后直接复制
+        CHECK(1, (int)Profile_Snapshot().stages[PROFILE_STRINGIFY_NUMBER].count);
+#endif
+        Json_Generate(expect, edited);
+        CHECK(expect, out);
+        d = 7.0 + i;
+    }
+}
+
+static void test_context()
+{
+    Context ctx;
+    const string json = "{\"id\":1,\"name\":\"a long enough string to need the scratch buffer\",\"tags\":[\"x\",\"y\"]}";
+    Value v1, v2;
+    CHECK(PARSE_OK, Json_Parse(json, v1));
+    CHECK(PARSE_OK, ctx.parse(json, v2));
+    bool same = v1 == v2;
+    CHECK(true, same);
+    size_t capacity = ctx.capacity();
+    bool retained = capacity != 0;
+    CHECK(true, retained);
+
+    // 再次使用时不会重新分配
+    CHECK(PARSE_OK, ctx.parse(json, v2));
+    CHECK(capacity, ctx.capacity());
+    CHECK(PARSE_MISS_QUOTATION_MARK, ctx.parse("[\"abc", v2));
+    CHECK(JSON_NULL, v2.get_type());
+    CHECK(PARSE_OK, ctx.parse(json, v2));
+    same = v1 == v2;
+    CHECK(true, same);
+
+    string out1, out2;
+    Json_Generate(out1, v1);
+    CHECK(GENERATE_OK, ctx.generate(out2, v1));
+    CHECK(out1, out2);
+    out2.clear();
+    CHECK(GENERATE_OK, ctx.generate(out2, v1));
+    CHECK(out1, out2);
+
+    // 超过阈值的缓冲区在调用结束后释放
+    ctx.set_trim_threshold(16);
+    CHECK(PARSE_OK, ctx.parse(json, v2));
+    out2.clear();
+    CHECK(GENERATE_OK, ctx.generate(out2, v1));
+    CHECK((size_t)0, ctx.capacity());
+    CHECK(out1, out2);
+
+    CHECK(&Context::local(), &Context::local());
+    Value v3;
+    CHECK(PARSE_OK, Context::local().parse(json, v3));
+    same = v1 == v3;
+    CHECK(true, same);
+}
+
+static void test_depth_limit()
+{
+    // 一百万层嵌套：解析与校验都在到达上限时停止，不会栈溢出
+    string deep = string(1000000, '[') + string(1000000, ']');
+    Value v;
+    CHECK(PARSE_DEPTH_EXCEEDED, Json_Parse(deep, v));
+    CHECK(JSON_NULL, v.get_type());
+    size_t offset;
+    CHECK(PARSE_DEPTH_EXCEEDED, Json_Validate(deep, &offset));
+    CHECK((size_t)1024, offset);
+
+    ParseOptions unlimited;
+    unlimited.max_depth = (size_t)-1;
+    CHECK(PARSE_OK, Json_Validate(deep, unlimited));
+    CHECK(PARSE_MISS_COMMA_OR_SQUARE_BRACKET, Json_Validate(deep.substr(0, 1999999) + "}", unlimited));
+    string deep_object;
+    for (int i = 0; i != 5000; ++i){
+        deep_object += "{\"a\":[";
+    }
+    deep_object += "1";
+    for (int i = 0; i != 5000; ++i){
+        deep_object += "]}";
+    }
+    CHECK(PARSE_OK, Json_Validate(deep_object, unlimited));
+
+    ParseOptions shallow;
+    shallow.max_depth = 3;
+    CHECK(PARSE_OK, Json_Parse("[[[1]]]", v, shallow));
+    CHECK(PARSE_DEPTH_EXCEEDED, Json_Parse("[[[[1]]]]", v, shallow));
+    CHECK(PARSE_OK, Json_Parse("{\"a\":{\"b\":[]}}", v, shallow));
+    CHECK(PARSE_DEPTH_EXCEEDED, Json_Parse("{\"a\":{\"b\":[{}]}}", v, shallow));
+    CHECK(PARSE_DEPTH_EXCEEDED, Json_Validate("[[[[1]]]]", shallow));
+    CHECK(PARSE_OK, Json_Validate("[[[]],[[1]]]", shallow));
+
+    // 深层的Value的生成与解析一致
+    ParseOptions wide;
+    wide.max_depth = 10000;
+    CHECK(PARSE_OK, Json_Parse(deep_object, v, wide));
+    string out;
+    CHECK(GENERATE_OK, Json_Generate(out, v));
+    CHECK(deep_object, out);
+    GenerateOptions pretty;
+    pretty.pretty = true;
+    pretty.format.indent = 0;
+    pretty.cache_fragments = true;
+    out.clear();
+    CHECK(GENERATE_OK, Json_Generate(out, v, pretty));
+    Value back;
+    CHECK(PARSE_OK, Json_Parse(out, back, wide));
+    bool same = v == back;
+    CHECK(true, same);
+
+    // MessagePack同样限制嵌套层数
+    string bin(2000, '\x91');
+    bin += '\xc0';
+    CHECK(PARSE_DEPTH_EXCEEDED, MsgPack_Decode(bin, v));
+    CHECK(PARSE_UNEXPECTED_END, MsgPack_Decode(string("\xdd\xff\xff\xff\xff", 5), v));
+}
+
+// 常驻内存只能在Linux上从/proc读取；AddressSanitizer会暂存已释放的内存，此时由LeakSanitizer检查泄漏
+#if defined(__linux__) && !defined(__SANITIZE_ADDRESS__)
+#define TEST_RESIDENT_MEMORY
+
+// 当前进程的常驻内存(KB)
+static long resident_kb()
+{
+    long pages = 0;
+    long resident = 0;
+    ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+#endif
+
+static void test_teardown()
+{
+    // 二十万层嵌套：递归析构会栈溢出
+    ParseOptions unlimited;
+    unlimited.max_depth = (size_t)-1;
+    string deep;
+    for (int i = 0; i != 200000; ++i){
+        deep += i % 2 ? "{\"k\":" : "[";
+    }
+    deep += "0";
+    for (int i = 200000; i != 0; --i){
+        deep += (i - 1) % 2 ? "}" : "]";
+    }
+    {
+        Value v;
+        CHECK(PARSE_OK, Json_Parse(deep, v, unlimited));
+        Value copy = v;
+        Value again;
+        CHECK(PARSE_OK, Json_Parse(deep, again, unlimited));
+        bool same = again == v;
+        CHECK(true, same);
+        Value other;
+        string changed = deep;
+        changed[deep.find('0')] = '1';
+        CHECK(PARSE_OK, Json_Parse(changed, other, unlimited));
+        same = other == v;
+        CHECK(false, same);
+        CHECK(again.hash(), v.hash());
+        string bin;
+        CHECK(GENERATE_OK, MsgPack_Encode(bin, v));
+        CHECK(400001, (int)bin.size());
+        Value unpacked;
+        CHECK(PARSE_DEPTH_EXCEEDED, MsgPack_Decode(bin, unpacked));
+        CHECK(GENERATE_OK, Json_Snapshot(bin, v));
+        Snapshot snap;
+        CHECK(PARSE_OK, snap.load(bin.data(), bin.size()));
+        CHECK(JSON_OBJECT, snap.root()[0].get_type());
+        CHECK(JSON_ARRAY, snap.root()[0]["k"].get_type());
+        v.free();
+        CHECK(JSON_NULL, v.get_type());
+        CHECK(JSON_ARRAY, copy.get_type());
+    }
+
+    // 反复解析并丢弃，常驻内存保持平稳(只在能读取常驻内存的平台上检查)
+    string json = "[";
+    for (int i = 0; i != 5000; ++i){
+        json += "{\"id\":" + to_string(i) + ",\"name\":\"user_" + to_string(i) + "\",\"tags\":[\"a\",\"b\"],\"o\":{\"x\":[1,2,3]}},";
+    }
+    json += "null]";
+#ifdef TEST_RESIDENT_MEMORY
+    long warm = 0;
+#endif
+    for (int i = 0; i != 60; ++i){
+        Value v;
+        Json_Parse(json, v);
+        Value copy = v;
+        copy[0]["id"] = -1.0;
+#ifdef TEST_RESIDENT_MEMORY
+        if(i == 10){
+            warm = resident_kb();
+        }
+#endif
+    }
+#ifdef TEST_RESIDENT_MEMORY
+    bool flat = warm > 0 && resident_kb() - warm < 2048;
+    CHECK(true, flat);
+#endif
+}
+
+static void test_utf8()
+{
+    // 解析时检查UTF-8：长字符串中间的非法字节也能发现(SIMD扫描路径)
+    ParseOptions strict;
+    strict.validate_utf8 = true;
+    Value v;
+    string ascii(100, 'a');
+    string valid = "\"" + ascii + "\xE4\xB8\xAD\xF0\x9F\x98\x80" + ascii + "\\n\"";
+    CHECK(PARSE_OK, Json_Parse(valid, v, strict));
+    CHECK(ascii + "\xE4\xB8\xAD\xF0\x9F\x98\x80" + ascii + "\n", v.get_string());
+    string invalid = "[\"" + ascii + "\xC0\xAF" + ascii + "\"]";
+    CHECK(PARSE_OK, Json_Parse(invalid, v));
+    CHECK(PARSE_INVALID_UTF8, Json_Parse(invalid, v, strict));
+    CHECK(JSON_NULL, v.get_type());
+    CHECK(PARSE_INVALID_UTF8, Json_Parse("{\"\xED\xA0\x80\":1}", v, strict));
+    CHECK(PARSE_INVALID_UTF8, Json_Parse("\"\xE2\x82\"", v, strict));
+    CHECK(PARSE_INVALID_UTF8, Json_Validate(invalid, strict));
+    CHECK(PARSE_INVALID_UTF8, Context::local().parse(invalid, v, strict));
+    CHECK(PARSE_OK, Context::local().parse(valid, v, strict));
+
+    // 生成时检查或替换
+    Value s;
+    s.set_string(ascii + "\xFF" + ascii + "\xE2\x82");
+    Value a;
+    Json_Parse("[null]", a);
+    a[0] = s;
+    string out;
+    CHECK(GENERATE_OK, Json_Generate(out, a));
+    CHECK("[\"" + ascii + "\xFF" + ascii + "\xE2\x82\"]", out);
+    GenerateOptions reject;
+    reject.invalid_utf8 = UTF8_VALIDATE;
+    out = "keep";
+    CHECK(GENERATE_INVALID_UTF8, Json_Generate(out, a, reject));
+    CHECK("keep", out);
+    GenerateOptions replace;
+    replace.invalid_utf8 = UTF8_REPLACE;
+    out.clear();
+    CHECK(GENERATE_OK, Json_Generate(out, a, replace));
+    CHECK("[\"" + ascii + "\xEF\xBF\xBD" + ascii + "\xEF\xBF\xBD\xEF\xBF\xBD\"]", out);
+    CHECK(PARSE_OK, Json_Parse(out, v, strict));
+
+    Value o;
+    Json_Parse("{}", o);
+    o.set_object_value("\x80", Value());
+    out.clear();
+    CHECK(GENERATE_INVALID_UTF8, Json_Generate(out, o, reject));
+    s.set_string("\xE4\xB8\xAD\t\"");
+    out.clear();
+    CHECK(GENERATE_OK, Json_Generate(out, s, reject));
+    CHECK("\"\xE4\xB8\xAD\\t\\\"\"", out);
+
+    // 未检查时缓存的片段不会被检查模式复用
+    GenerateOptions cached;
+    cached.cache_fragments = true;
+    out.clear();
+    CHECK(GENERATE_OK, Json_Generate(out, a, cached));
+    reject.cache_fragments = true;
+    out.clear();
+    CHECK(GENERATE_INVALID_UTF8, Json_Generate(out, a, reject));
+}
+
+static void test_ensure_ascii()
+{
+    GenerateOptions ascii;
+    ascii.ensure_ascii = true;
+    Value v;
+    string out;
+    // 2/3/4字节序列，BMP以外输出代理对
+    v.set_string("a\xC3\xA9\xE4\xB8\xAD\xF0\x9F\x98\x80\x01\"");
+    CHECK(GENERATE_OK, Json_Generate(out, v, ascii));
+    CHECK("\"a\\u00E9\\u4E2D\\uD83D\\uDE00\\u0001\\\"\"", out);
+    Value back;
+    CHECK(PARSE_OK, Json_Parse(out, back));
+    CHECK(v.get_string(), back.get_string());
+
+    // 纯ASCII的长字符串原样输出
+    v.set_string(string(1000, 'x'));
+    out.clear();
+    CHECK(GENERATE_OK, Json_Generate(out, v, ascii));
+    CHECK("\"" + string(1000, 'x') + "\"", out);
+
+    // 解析->ASCII输出->解析得到相同的Value
+    string json = "{\"\xE5\x90\x8D\":[\"\xF0\x90\x8D\x88\xEF\xBF\xBF\",\"\xDF\xBF" + string(40, 'y') + "\xE0\xA0\x80\"],\"k\":\"\\u0000\"}";
+    CHECK(PARSE_OK, Json_Parse(json, v));
+    out.clear();
+    CHECK(GENERATE_OK, Json_Generate(out, v, ascii));
+    bool only_ascii = true;
+    for(char ch : out){
+        only_ascii = only_ascii && (unsigned char)ch < 0x80;
+    }
+    CHECK(true, only_ascii);
+    CHECK(PARSE_OK, Json_Parse(out, back));
+    bool same = v == back;
+    CHECK(true, same);
+    GenerateOptions pretty_ascii = ascii;
+    pretty_ascii.pretty = true;
+    out.clear();
+    CHECK(GENERATE_OK, Json_Generate(out, v, pretty_ascii));
+    CHECK(PARSE_OK, Json_Parse(out, back));
+    same = v == back;
+    CHECK(true, same);
+
+    // 非法字节输出为\uFFFD，或在UTF8_VALIDATE时报错
+    v.set_string("a\xFF" "b");
+    out.clear();
+    CHECK(GENERATE_OK, Json_Generate(out, v, ascii));
+    CHECK("\"a\\uFFFDb\"", out);
+    ascii.invalid_utf8 = UTF8_VALIDATE;
+    out.clear();
+    CHECK(GENERATE_INVALID_UTF8, Json_Generate(out, v, ascii));
+}
+
+static void test_profile()
+{
+    LatencyHistogram h;
+    for (uint64_t i = 1; i <= 100; ++i){
+        h.record(i * 1000);
+    }
+    CHECK((size_t)100, h.count);
+    CHECK((size_t)65536, h.percentile(0.5));        // 50000ns落在[32768, 65536)
+    CHECK((size_t)131072, h.percentile(0.99));
+    CHECK((size_t)0, LatencyHistogram().percentile(0.5));
+
+    Profile_Reset();
+    string json = "{\"a\":[1,2,\"x\"],\"b\":\"yz\",\"c\":{}}";
+    Value v;
+    CHECK(PARSE_OK, Json_Parse(json, v));
+    string out;
+    CHECK(GENERATE_OK, Json_Generate(out, v));
+    ProfileSnapshot s = Profile_Snapshot();
+#ifdef JSONCPP_PROFILE
+    CHECK((size_t)1, s.stages[PROFILE_PARSE].count);
+    CHECK(json.size(), s.stages[PROFILE_PARSE].bytes);
+    CHECK((size_t)5, s.stages[PROFILE_PARSE_STRING].count);        // 3个键和2个字符串
+    CHECK((size_t)2, s.stages[PROFILE_PARSE_NUMBER].count);
+    CHECK((size_t)3, s.stages[PROFILE_PARSE_CONTAINER].count);
+    CHECK((size_t)1, s.stages[PROFILE_GENERATE].count);
+    CHECK(out.size(), s.stages[PROFILE_GENERATE].bytes);
+    CHECK((size_t)5, s.stages[PROFILE_STRINGIFY_STRING].count);
+    CHECK((size_t)2, s.stages[PROFILE_STRINGIFY_NUMBER].count);
+    CHECK((size_t)3, s.stages[PROFILE_STRINGIFY_CONTAINER].count);
+    bool grew = s.stages[PROFILE_BUFFER_GROW].count > 0;
+    CHECK(true, grew);
+    CHECK((size_t)1, s.parse_latency.count);
+    CHECK((size_t)1, s.generate_latency.count);
+    ProfileSnapshot merged = s;
+    merged.merge(s);
+    CHECK((size_t)2, merged.stages[PROFILE_PARSE].count);
+    CHECK((size_t)2, merged.parse_latency.count);
+#else
+    for (int i = 0; i != PROFILE_STAGE_COUNT; ++i){
+        CHECK((size_t)0, s.stages[i].count);
+    }
+    CHECK((size_t)0, s.parse_latency.count);
+#endif
+    Profile_Reset();
+    CHECK((size_t)0, Profile_Snapshot().stages[PROFILE_PARSE].count);
+}
+
+static void test_integer()
+{
+    // 没有小数和指数部分的数字保存为64位整数，超过2^53也不丢失精度
+    Value v;
+    string out;
+    const char *exact[] = {"9007199254740993", "-9223372036854775808", "9223372036854775807",
+                           "18446744073709551615", "0", "-1", "[1,-2,{\"k\":123456789012345678}]"};
+    for(const char *json : exact){
+        CHECK(PARSE_OK, Json_Parse(json, v));
+        out.clear();
+        CHECK(GENERATE_OK, Json_Generate(out, v));
+        CHECK(string(json), out);
+    }
+    CHECK(PARSE_OK, Json_Parse("9007199254740993", v));
+    CHECK(true, v.is_int64());
+    CHECK(9007199254740993LL, (long long)v.get_int64());
+    CHECK(9007199254740992.0, v.get_number());
+    CHECK(PARSE_OK, Json_Parse("18446744073709551615", v));
+    CHECK(false, v.is_int64());
+    CHECK(true, v.is_uint64());
+    CHECK(18446744073709551615ULL, (unsigned long long)v.get_uint64());
+    CHECK(PARSE_OK, Json_Parse("-5", v));
+    CHECK(false, v.is_uint64());
+    CHECK(-5LL, (long long)v.get_int64());
+
+    // 超出范围、带小数或指数的数字，以及-0，仍为double
+    const char *doubles[] = {"18446744073709551616", "-9223372036854775809", "1.0", "1e3", "-0"};
+    for(const char *json : doubles){
+        CHECK(PARSE_OK, Json_Parse(json, v));
+        bool integer = v.is_int64() || v.is_uint64();
+        CHECK(false, integer);
+    }
+    out.clear();
+    CHECK(GENERATE_OK, Json_Generate(out, v));
+    CHECK("-0", out);
+
+    // 整数与值相同的double相等，哈希也相同；不能精确表示的不相等
+    Value i, d;
+    CHECK(PARSE_OK, Json_Parse("[1,4611686018427387904]", i));
+    CHECK(PARSE_OK, Json_Parse("[1.0,4.611686018427387904e18]", d));
+    bool same = i == d;
+    CHECK(true, same);
+    CHECK(i.hash(), d.hash());
+    CHECK(PARSE_OK, Json_Parse("9007199254740993", i));
+    d.set_number(9007199254740992.0);
+    same = i == d;
+    CHECK(false, same);
+    i.set_uint64(7);
+    CHECK(true, i.is_int64());
+    d.set_int64(7);
+    same = i == d;
+    CHECK(true, same);
+
+    // MessagePack和快照保留整数
+    CHECK(PARSE_OK, Json_Parse("[9007199254740993,-9007199254740993,18446744073709551615,0.5]", v));
+    string bin;
+    CHECK(GENERATE_OK, MsgPack_Encode(bin, v));
+    Value back;
+    CHECK(PARSE_OK, MsgPack_Decode(bin, back));
+    same = v == back;
+    CHECK(true, same);
+    CHECK(-9007199254740993LL, (long long)back[1].get_int64());
+    CHECK(GENERATE_OK, Json_Snapshot(bin, v));
+    Snapshot snap;
+    CHECK(PARSE_OK, snap.load(bin.data(), bin.size()));
+    CHECK(9007199254740993LL, (long long)snap.root()[0].get_int64());
+    CHECK(-9007199254740993LL, (long long)snap.root()[1].get_int64());
+    CHECK(18446744073709551615ULL, (unsigned long long)snap.root()[2].get_uint64());
+    CHECK(0.5, snap.root()[3].get_number());
+
+    // 结构体绑定按整数读写
+    BindIds ids;
+    CHECK(PARSE_OK, Json_Parse_Into("{\"id\":9007199254740993,\"big\":18446744073709551615,\"small\":-7}", ids));
+    CHECK(9007199254740993LL, ids.id);
+    CHECK(18446744073709551615ULL, ids.big);
+    CHECK(-7, (int)ids.small);
+    out.clear();
+    CHECK(GENERATE_OK, Json_Generate_From(out, ids));
+    CHECK(PARSE_OK, Json_Parse(out, v));
+    CHECK(9007199254740993LL, (long long)v["id"].get_int64());
+    CHECK(18446744073709551615ULL, (unsigned long long)v["big"].get_uint64());
+    CHECK(PARSE_OK, Json_Parse_Into("{\"id\":1e3,\"big\":2.0,\"small\":0}", ids));
+    CHECK(1000LL, ids.id);
+    CHECK(PARSE_TYPE_MISMATCH, Json_Parse_Into("{\"small\":40000}", ids));
+    CHECK(PARSE_TYPE_MISMATCH, Json_Parse_Into("{\"big\":-1}", ids));
+    CHECK(PARSE_TYPE_MISMATCH, Json_Parse_Into("{\"id\":9223372036854775808}", ids));
+    CHECK(PARSE_TYPE_MISMATCH, Json_Parse_Into("{\"id\":0.5}", ids));
+}
+
+static void test_raw_numbers()
+{
+    ParseOptions raw;
+    raw.raw_numbers = true;
+    Value v;
+    string json = "[1.10,-0.0,1E+2,123456789012345678901234567890,0.1000000000000000055511151231257827,3]";
+    CHECK(PARSE_OK, Json_Parse(json, v, raw));
+    CHECK(true, v[0].is_raw_number());
+    CHECK("1.10", v[0].get_raw_number());
+    // 生成时原样输出
+    string out;
+    CHECK(GENERATE_OK, Json_Generate(out, v));
+    CHECK(json, out);
+    out.clear();
+    CHECK(GENERATE_OK, Context::local().generate(out, v));
+    CHECK(json, out);
+
+    // 用到时才转换
+    CHECK(1.1, v[0].get_number());
+    CHECK(100.0, v[2].get_number());
+    CHECK(1.2345678901234568e29, v[3].get_number());
+    CHECK(true, v[5].is_int64());
+    CHECK(3LL, (long long)v[5].get_int64());
+    CHECK(false, v[0].is_int64());
+    // 直接转换，与解析得到的存储方式相同，不再经过Json_Parse
+    Value ints;
+    CHECK(PARSE_OK, Json_Parse("[-9223372036854775808,18446744073709551615,-0,18446744073709551616]", ints, raw));
+    Profile_Reset();
+    CHECK(true, ints[0].is_int64());
+    bool limit = ints[0].get_int64() == INT64_MIN;
+    CHECK(true, limit);
+    CHECK(true, ints[1].is_uint64());
+    limit = ints[1].get_uint64() == UINT64_MAX;
+    CHECK(true, limit);
+    CHECK(false, ints[2].is_int64());
+    CHECK(true, (bool)signbit(ints[2].get_number()));
+    CHECK(false, ints[3].is_uint64());
+    CHECK(1.8446744073709552e19, ints[3].get_number());
+    CHECK(0, (int)Profile_Snapshot().stages[PROFILE_PARSE].count);
+
+    // 与转换后的值比较和哈希
+    Value cooked;
+    CHECK(PARSE_OK, Json_Parse(json, cooked));
+    bool same = v == cooked;
+    CHECK(true, same);
+    CHECK(cooked.hash(), v.hash());
+    Value copy = v;
+    CHECK("1E+2", copy[2].get_raw_number());
+    copy[2] = 5.0;
+    CHECK(false, copy[2].is_raw_number());
+    CHECK("1E+2", v[2].get_raw_number());
+
+    // MessagePack和快照中保存转换后的值
+    string bin;
+    CHECK(GENERATE_OK, MsgPack_Encode(bin, v));
+    Value back;
+    CHECK(PARSE_OK, MsgPack_Decode(bin, back));
+    same = back == cooked;
+    CHECK(true, same);
+    CHECK(GENERATE_OK, Json_Snapshot(bin, v));
+    Snapshot snap;
+    CHECK(PARSE_OK, snap.load(bin.data(), bin.size()));
+    CHECK(1.1, snap.root()[0].get_number());
+    CHECK(3LL, (long long)snap.root()[5].get_int64());
+
+    // 语法错误仍然报告，超出double范围的数字在转换时为HUGE_VAL
+    CHECK(PARSE_INVALID_VALUE, Json_Parse("[1.]", v, raw));
+    CHECK(PARSE_OK, Json_Parse("1e400", v, raw));
+    CHECK(HUGE_VAL, v.get_number());
+    CHECK(PARSE_NUMBER_TOO_BIG, Json_Parse("1e400", v));
+}
+
+static void test_raw_json()
+{
+    // 已序列化的片段原样嵌入输出
+    Value doc;
+    CHECK(PARSE_OK, Json_Parse("{\"id\":7,\"cached\":null}", doc));
+    string fragment = "{\"items\":[1,2,3],\"name\":\"a\\u00e9\"}";
+    CHECK(PARSE_OK, doc["cached"].set_raw_json(fragment));
+    CHECK(JSON_RAW, doc["cached"].get_type());
+    CHECK(fragment, doc["cached"].get_raw_json());
+    Value v;
+    CHECK(PARSE_OK, Json_Parse("[null]", v));
+    v[0] = doc["cached"];
+    string out;
+    CHECK(GENERATE_OK, Json_Generate(out, v));
+    CHECK("[" + fragment + "]", out);
+    GenerateOptions cached;
+    cached.cache_fragments = true;
+    out.clear();
+    CHECK(GENERATE_OK, Json_Generate(out, v, cached));
+    CHECK("[" + fragment + "]", out);
+
+    // 校验失败时不修改
+    Value raw;
+    CHECK(PARSE_MISS_COMMA_OR_SQUARE_BRACKET, raw.set_raw_json("[1,2"));
+    CHECK(JSON_NULL, raw.get_type());
+    CHECK(PARSE_OK, raw.set_raw_json("[1,2", false));
+    CHECK(JSON_RAW, raw.get_type());
+    // 不合法的片段不能转为二进制格式
+    string invalid_bin;
+    CHECK(PARSE_MISS_COMMA_OR_SQUARE_BRACKET, MsgPack_Encode(invalid_bin, raw));
+    CHECK(PARSE_MISS_COMMA_OR_SQUARE_BRACKET, Json_Snapshot(invalid_bin, raw));
+    // 不校验时可以存入空的片段，生成时不输出任何内容
+    Value empty;
+    CHECK(PARSE_OK, empty.set_raw_json("", false));
+    out.clear();
+    CHECK(GENERATE_OK, Json_Generate(out, empty));
+    CHECK("", out);
+
+    // 与解析后的值比较、哈希相同；MessagePack和快照中保存解析后的值
+    Value parsed;
+    CHECK(PARSE_OK, Json_Parse(fragment, parsed));
+    bool same = doc["cached"] == parsed;
+    CHECK(true, same);
+    CHECK(parsed.hash(), doc["cached"].hash());
+    same = doc["cached"] == doc["id"];
+    CHECK(false, same);
+    string bin;
+    CHECK(GENERATE_OK, MsgPack_Encode(bin, doc));
+    Value back;
+    CHECK(PARSE_OK, MsgPack_Decode(bin, back));
+    CHECK(JSON_OBJECT, back["cached"].get_type());
+    same = back == doc;
+    CHECK(true, same);
+    CHECK(GENERATE_OK, Json_Snapshot(bin, doc));
+    Snapshot snap;
+    CHECK(PARSE_OK, snap.load(bin.data(), bin.size()));
+    CHECK(3, (int)snap.root()["cached"]["items"].size());
+
+    // 复制共享片段
+    Value copy = doc;
+    CHECK(true, copy["cached"].is_shared());
+    copy.free();
+    v.free();
+    CHECK(false, doc["cached"].is_shared());
+}
+
+static void test_writer()
+{
+    // 输出与构造Value后生成的文本等价
+    string out;
+    Writer w(out);
+    w.start_object();
+    w.key("big");
+    w.uint64(18446744073709551615ULL);
+    w.key("id");
+    w.int64(7);
+    w.key("list");
+    w.start_array();
+    w.int64(-3);
+    w.start_array();
+    w.end_array();
+    w.start_object();
+    w.end_object();
+    w.end_array();
+    w.key(string("name"));
+    w.string("a\"b");
+    w.key("none");
+    w.null();
+    w.key("ok");
+    w.boolean(true);
+    w.key("raw");
+    w.raw("[1,2]", 5);
+    w.key("score");
+    w.number(2.5);
+    w.end_object();
+    CHECK(GENERATE_OK, w.finish());
+    CHECK("{\"big\":18446744073709551615,\"id\":7,\"list\":[-3,[],{}],\"name\":\"a\\\"b\","
+          "\"none\":null,\"ok\":true,\"raw\":[1,2],\"score\":2.5}", out);
+    Value v, expect;
+    CHECK(PARSE_OK, Json_Parse(out, v));
+    CHECK(PARSE_OK, Json_Parse("{\"score\":2.5,\"raw\":[1,2],\"ok\":true,\"none\":null,\"name\":\"a\\\"b\","
+                               "\"list\":[-3,[],{}],\"id\":7,\"big\":18446744073709551615}", expect));
+    bool same = v == expect;
+    CHECK(true, same);
+
+    // 缩进格式与Generator相同，空容器不换行
+    GenerateOptions pretty;
+    pretty.pretty = true;
+    CHECK(PARSE_OK, Json_Parse("[1,[],{\"a\":[2]}]", expect));
+    string generated;
+    CHECK(GENERATE_OK, Json_Generate(generated, expect, pretty));
+    out.clear();
+    Writer p(out, pretty);
+    p.start_array();
+    p.int64(1);
+    p.start_array();
+    p.end_array();
+    p.start_object();
+    p.key("a");
+    p.start_array();
+    p.int64(2);
+    p.end_array();
+    p.end_object();
+    p.end_array();
+    CHECK(GENERATE_OK, p.finish());
+    CHECK(generated, out);
+
+    // finish之后继续写下一个文档；输出到ostream
+    ostringstream os;
+    Writer s(os);
+    for (int i = 0; i != 3; ++i){
+        s.start_array();
+        s.int64(i);
+        s.end_array();
+        CHECK(GENERATE_OK, s.finish());
+        os << '\n';
+    }
+    CHECK("[0]\n[1]\n[2]\n", os.str());
+
+    // 字符串的UTF-8检查失败时由finish返回错误码
+    GenerateOptions strict;
+    strict.invalid_utf8 = UTF8_VALIDATE;
+    out.clear();
+    Writer u(out, strict);
+    u.string("\xFF", 1);
+    CHECK(GENERATE_INVALID_UTF8, u.finish());
+    out.clear();
+    u.string("ok");
+    CHECK(GENERATE_OK, u.finish());
+    CHECK("\"ok\"", out);
+}
+
+static void test_build()
+{
+    // 从空容器开始逐个添加
+    Value arr;
+    arr.set_array();
+    CHECK(JSON_ARRAY, arr.get_type());
+    CHECK(0, arr.get_array_size());
+    arr.reserve(4);
+    arr.push_back(Value(1.0));
+    Value s("abc");
+    arr.push_back(s);
+    Value moved("moved");
+    arr.push_back(move(moved));
+    CHECK(JSON_NULL, moved.get_type());
+    arr.emplace_back(std::string("xyz")).set_string("emplaced");
+    arr.insert_array_element(Value(0.0), 0);
+    arr.insert_array_element(Value(9.0), arr.get_array_size());
+    string out;
+    CHECK(GENERATE_OK, Json_Generate(out, arr));
+    CHECK("[0,1,\"abc\",\"moved\",\"emplaced\",9]", out);
+
+    Value obj;
+    obj.set_object();
+    obj.reserve(8);
+    obj.insert_or_assign("a", Value(1.0));
+    string key = "b";
+    Value b("bee");
+    Value &slot = obj.insert_or_assign(move(key), move(b));
+    CHECK("bee", slot.get_string());
+    CHECK(JSON_NULL, b.get_type());
+    Value replaced(2.0);
+    obj.insert_or_assign(string("a"), move(replaced));
+    CHECK(2.0, obj["a"].get_number());
+    obj.set_object_value("c", move(arr));
+    CHECK(JSON_NULL, arr.get_type());
+    CHECK(3, obj.get_object_size());
+    CHECK(6, obj["c"].get_array_size());
+
+    // 共享的容器在修改前复制
+    Value copy = obj;
+    copy.insert_or_assign("d", Value(4.0));
+    CHECK(3, obj.get_object_size());
+    CHECK(4, copy.get_object_size());
+    Value parsed;
+    CHECK(PARSE_OK, Json_Parse("[]", parsed));
+    parsed.push_back(obj);
+    CHECK(true, obj.is_shared());
+    parsed[0].insert_or_assign("e", Value(5.0));
+    CHECK(3, obj.get_object_size());
+}
+
+static void test_stream_reader()
+{
+    // 文档之间以空白分隔；窗口很小时文档跨越多次读入
+    const char *docs[] = {"{\"a\":[1,2,{\"b\":\"x]}\\\"\"}]}", "[]", "\"s t\\\\\"", "-12.5e3", "true", "null", "{}"};
+    string input = " \n";
+    for (const char *d : docs){
+        input += d;
+        input += "\n";
+    }
+    input += "1 2\t[3]\"4\"";
+    size_t windows[] = {1, 3, 64 * 1024};
+    for (int i = 0; i != 6; ++i){
+        size_t w = windows[i % 3];
+        istringstream is(input);
+        StreamReader reader(is, w, ParseOptions(), i >= 3);
+        Value v, expect;
+        for (const char *d : docs){
+            CHECK(PARSE_OK, reader.next(v));
+            CHECK(PARSE_OK, Json_Parse(d, expect));
+            bool same = v == expect;
+            CHECK(true, same);
+        }
+        double rest[] = {1, 2};
+        for (double n : rest){
+            CHECK(PARSE_OK, reader.next(v));
+            CHECK(n, v.get_number());
+        }
+        CHECK(PARSE_OK, reader.next(v));
+        CHECK(JSON_ARRAY, v.get_type());
+        CHECK(PARSE_OK, reader.next(v));
+        CHECK("4", v.get_string());
+        CHECK(STREAM_END, reader.next(v));
+        CHECK(JSON_NULL, v.get_type());
+        CHECK(STREAM_END, reader.next(v));
+        CHECK(input.size(), reader.offset());
+    }
+
+    // 出错的文档被跳过，之后继续读取；最后一个文档不完整
+    istringstream bad("[1,}\n{\"a\":1}\ntruex 7 [1,2");
+    StreamReader br(bad, 4);
+    Value v;
+    CHECK(PARSE_INVALID_VALUE, br.next(v));
+    CHECK(PARSE_OK, br.next(v));
+    CHECK(1.0, v["a"].get_number());
+    CHECK(PARSE_ROOT_NOT_SINGULAR, br.next(v));
+    CHECK(PARSE_OK, br.next(v));
+    CHECK(7.0, v.get_number());
+    CHECK(PARSE_MISS_COMMA_OR_SQUARE_BRACKET, br.next(v));
+    CHECK(STREAM_END, br.next(v));
+
+    // 过大的文档：已读完的直接跳过，未读完的丢弃到下一个换行，窗口不会随之增长
+    ParseOptions limited;
+    limited.max_document_size = 16;
+    string huge = "[" + string(100000, '1') + "] 2\n";
+    istringstream hs("[1,2,3,4,5,6,7,8,9] [1]\n" + huge + "{\"b\":2}");
+    StreamReader hr(hs, 8, limited);
+    CHECK(STREAM_DOCUMENT_TOO_LARGE, hr.next(v));
+    CHECK(JSON_NULL, v.get_type());
+    CHECK(PARSE_OK, hr.next(v));
+    CHECK(1.0, v[0].get_number());
+    CHECK(STREAM_DOCUMENT_TOO_LARGE, hr.next(v));
+    CHECK(PARSE_OK, hr.next(v));
+    CHECK(2.0, v["b"].get_number());
+    CHECK(STREAM_END, hr.next(v));
+    bool small = hr.capacity() < 1024;
+    CHECK(true, small);
+    istringstream whole("[1,2,3,4,5,6,7,8,9] {}");
+    StreamReader wr(whole, 64 * 1024, limited);
+    CHECK(STREAM_DOCUMENT_TOO_LARGE, wr.next(v));
+    CHECK(PARSE_OK, wr.next(v));
+    CHECK(JSON_OBJECT, v.get_type());
+    CHECK(STREAM_END, wr.next(v));
+    istringstream tail("[" + string(100, '1'));
+    StreamReader tr(tail, 8, limited);
+    CHECK(STREAM_DOCUMENT_TOO_LARGE, tr.next(v));
+    CHECK(STREAM_END, tr.next(v));
+    // 文档之间大量的空行和空白不计入窗口
+    string padded = "[1]" + string(100000, '\n') + string(100000, ' ') + "[2]";
+    istringstream ps(padded);
+    StreamReader pad_reader(ps, 8, limited);
+    CHECK(PARSE_OK, pad_reader.next(v));
+    CHECK(PARSE_OK, pad_reader.next(v));
+    CHECK(2.0, v[0].get_number());
+    CHECK(padded.size(), pad_reader.offset());
+    CHECK(STREAM_END, pad_reader.next(v));
+    small = pad_reader.capacity() < 1024;
+    CHECK(true, small);
+
+    // 窗口大小只取决于最大的文档
+    string many;
+    for (int i = 0; i != 10000; ++i){
+        many += "{\"id\":" + to_string(i) + "}\n";
+    }
+    istringstream ms(many);
+    StreamReader mr(ms, 64);
+    int n = 0;
+    while (mr.next(v) == PARSE_OK){
+        ++n;
+    }
+    CHECK(10000, n);
+    bool bounded = mr.capacity() < 1024;
+    CHECK(true, bounded);
+
+#ifndef _WIN32
+    // 文件描述符
+    int fds[2];
+    CHECK(0, pipe(fds));
+    string piped = "{\"x\":1} [2]";
+    CHECK((ssize_t)piped.size(), write(fds[1], piped.data(), piped.size()));
+    close(fds[1]);
+    StreamReader fr(fds[0], 5);
+    CHECK(PARSE_OK, fr.next(v));
+    CHECK(1.0, v["x"].get_number());
+    CHECK(PARSE_OK, fr.next(v));
+    CHECK(2.0, v[0].get_number());
+    CHECK(STREAM_END, fr.next(v));
+    close(fds[0]);
+    StreamReader closed(fds[0]);
+    CHECK(STREAM_IO_ERROR, closed.next(v));
+
+    // 后台线程预读文件；提前析构时读线程被停止
+    const char *path = "stream_test.ndjson";
+    ofstream(path) << many;
+    int file = open(path, O_RDONLY);
+    StreamReader pr(file, 256, ParseOptions(), true);
+    n = 0;
+    bool in_order = true;
+    while (pr.next(v) == PARSE_OK){
+        in_order = in_order && v["id"].get_int64() == n;
+        ++n;
+    }
+    CHECK(10000, n);
+    CHECK(true, in_order);
+    CHECK(many.size(), pr.offset());
+    close(file);
+    file = open(path, O_RDONLY);
+    {
+        StreamReader early(file, 16, ParseOptions(), true);
+        CHECK(PARSE_OK, early.next(v));
+    }
+    close(file);
+    remove(path);
+#endif
+    StreamReader failed(-1, 16, ParseOptions(), true);
+    CHECK(STREAM_IO_ERROR, failed.next(v));
+    CHECK(STREAM_IO_ERROR, failed.next(v));
+}
+
+static void test_shared_document()
+{
+    SharedDocument doc;
+    CHECK(JSON_NULL, doc.read()->get_type());
+    CHECK(PARSE_OK, doc.reload("{\"a\":1,\"b\":1}"));
+    CHECK(1, (int)doc.version());
+    {
+        SharedDocument::Guard g = doc.read();
+        CHECK(1.0, (*g)["a"].get_number());
+    }
+    // 解析失败时保持原来的文档
+    CHECK(PARSE_MISS_COMMA_OR_CURLY_BRACKET, doc.reload("{\"a\":2"));
+    CHECK(1, (int)doc.version());
+    Value old = doc.load();
+
+    // 替换后复制出的旧文档仍然有效
+    Value next;
+    CHECK(PARSE_OK, Json_Parse("{\"a\":2,\"b\":2}", next));
+    doc.store(move(next));
+    CHECK(2, (int)doc.version());
+    CHECK(1.0, old["a"].get_number());
+    CHECK(2.0, doc.load()["b"].get_number());
+
+    // 读者与替换并发：每次读到的都是完整的某个版本
+    std::atomic<bool> done(false);
+    std::atomic<int> torn(0);
+    vector<thread> readers;
+    for (int i = 0; i != 2; ++i){
+        readers.push_back(thread([&]{
+            while (!done.load()){
+                {
+                    SharedDocument::Guard g = doc.read();
+                    if ((*g)["a"].get_int64() != (*g)["b"].get_int64()){
+                        ++torn;
+                    }
+                }
+                this_thread::yield();
+            }
+        }));
+    }
+    for (int i = 3; i != 100; ++i){
+        string json = "{\"a\":" + to_string(i) + ",\"b\":" + to_string(i) + "}";
+        CHECK(PARSE_OK, doc.reload(json));
+    }
+    done = true;
+    for (auto & t : readers){
+        t.join();
+    }
+    CHECK(0, torn.load());
+    CHECK(99, (int)doc.version());
+    CHECK(99, (int)doc.read()->operator[]("a").get_int64());
+}
+
 static void test_move()
 {
     vector<Value> vec;
@@ -556,11 +2219,32 @@ static void test_move()
 
 int main()
 {   
- //   test_parse();
- //   test_stringify();
- //   test_print();
- //   test_move();
- //   cout << test_pass << "/" << test_count << " (" << 100 * test_pass / test_count << "%)" << endl;
+    test_parse();
+    test_stringify();
+    test_print();
+    test_format();
+    test_msgpack();
+    test_snapshot();
+    test_keyset();
+    test_bind();
+    test_move();
+    test_copy_on_write();
+    test_hash();
+    test_fragment_cache();
+    test_context();
+    test_depth_limit();
+    test_teardown();
+    test_utf8();
+    test_ensure_ascii();
+    test_profile();
+    test_integer();
+    test_raw_numbers();
+    test_raw_json();
+    test_writer();
+    test_build();
+    test_stream_reader();
+    test_shared_document();
+    cout << test_pass << "/" << test_count << " (" << 100 * test_pass / test_count << "%)" << endl;
     cin.get();
     return 0;
 }